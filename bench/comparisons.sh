@@ -0,0 +1,37 @@
+#!/bin/sh
+# Measure code generated for comparison-heavy functions.
+#
+# Usage: bench/comparisons.sh [repeat]
+#
+# Counts the points of a 1000 x 1000 grid inside a box, REPEAT times, and
+# evaluates a piecewise function built from comparisons. Prints the wall time
+# and the number of conversions between i1 and double in the generated IR.
+# Set BASELINE to another build of kaleidoscope to compare with it.
+
+set -e
+
+REPEAT=${1:-20}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v repeat="$REPEAT" 'BEGIN {
+    print "def inbox(x, y) (0.25 < x) * (x < 0.75) * (0.25 < y) * (y < 0.75);"
+    print "def count(n) sum(i = 0, n, sum(j = 0, n, inbox(i * 0.001, j * 0.001)));"
+    print "def tent(x) (x < 0.5) * x + (0.5 < x) * (1 - x);"
+    print "def area(n) sum(i = 0, n, tent(i * 0.000001));"
+    for (r = 0; r < repeat; r++) {
+        print "count(1000);"
+        print "area(1000000);"
+    }
+}' > "$WORK/input.ks"
+
+for bin in "$BIN" $BASELINE; do
+    echo "$bin:"
+    start=$(date +%s.%N)
+    "$bin" --emit=none < "$WORK/input.ks" > /dev/null 2>&1
+    end=$(date +%s.%N)
+    echo "  $(echo "$end - $start" | bc) s"
+    "$bin" --emit=llvm-ir < "$WORK/input.ks" 2>/dev/null \
+        | awk '/ uitofp / { n++ } END { print "  " n + 0 " uitofp instructions" }'
+done
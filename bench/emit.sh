@@ -0,0 +1,34 @@
+#!/bin/sh
+# Measure how much each emit mode adds to the time of running a large input.
+#
+# Usage: bench/emit.sh [definitions]
+#
+# Generates DEFS small definitions, each followed by a call, and runs the
+# input once per emit mode with the emitted output discarded.
+
+set -e
+
+DEFS=${1:-2000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# identifiers cannot contain digits, so functions are named fa, fb, ...
+awk -v defs="$DEFS" 'function name(i,  s) {
+    s = ""
+    do { s = sprintf("%c", 97 + i % 26) s; i = int(i / 26) } while (i > 0)
+    return "f" s
+}
+BEGIN {
+    for (i = 0; i < defs; i++) {
+        printf "def %s(x, y) x * %d + y * (x - %d.5);\n", name(i), i, i
+        printf "%s(%d, 2);\n", name(i), i
+    }
+}' > "$WORK/input.ks"
+
+for mode in none trace tokens ast llvm-ir bitcode obj; do
+    start=$(date +%s.%N)
+    "$BIN" --emit=$mode --output=/dev/null < "$WORK/input.ks" 2>/dev/null
+    end=$(date +%s.%N)
+    echo "$mode: $(echo "$end - $start" | bc) s"
+done
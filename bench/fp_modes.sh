@@ -0,0 +1,45 @@
+#!/bin/sh
+# Compare the floating-point modes of kaleidoscope.
+#
+# Usage: bench/fp_modes.sh [number-of-expressions]
+#
+# Generates a script that evaluates `a * b + c` and a few longer sums on
+# inputs chosen so that rounding differs between separate and fused
+# operations, runs it under every --fp-mode, and reports the wall time of
+# each mode and the results that differ from the strict mode.
+
+set -e
+
+N=${1:-10000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Numbers are printed without exponents and negative ones as (0 - x),
+# since the lexer knows neither; identifiers cannot contain digits.
+awk -v n="$N" 'BEGIN {
+    print "def muladd(a, b, c) a * b + c;"
+    print "def sumfour(a, b, c, d) a + b + c + d;"
+    print "def poly(x) 1 + x * (1 + x * (0.5 + x * (0.16666666666666666 + x * 0.041666666666666664)));"
+    for (i = 1; i <= n; i++) {
+        x = i / 7.0
+        printf "muladd(%.17f, %.17f, (0 - 1));\n", 0.1 * i, 10.0 / i
+        printf "sumfour(%.1f, %.17f, (0 - %.1f), %.17f);\n", 1e16, x, 1e16, x
+        printf "poly(%.20f);\n", x / n
+    }
+}' > "$WORK/input.ks"
+
+for mode in strict contract fast; do
+    start=$(date +%s.%N)
+    "$BIN" --fp-mode=$mode --mcpu=native < "$WORK/input.ks" 2>&1 >/dev/null \
+        | sed -n 's/^Evaluated to //p' > "$WORK/$mode.txt"
+    end=$(date +%s.%N)
+    echo "$mode: $(echo "$end - $start" | bc) s"
+done
+
+for mode in contract fast; do
+    echo "results differing between strict and $mode:"
+    paste "$WORK/strict.txt" "$WORK/$mode.txt" \
+        | awk -F '\t' '$1 != $2 { d++; if (d <= 10) printf "  line %d: %s vs %s\n", NR, $1, $2 }
+                       END { printf "  %d of %d\n", d, NR }'
+done
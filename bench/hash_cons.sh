@@ -0,0 +1,49 @@
+#!/bin/sh
+# Measure what hash-consing saves on a script.
+#
+# Usage: bench/hash_cons.sh [script.ks]
+#
+# Runs kaleidoscope on the script (by default a generated one full of
+# repeated subexpressions) with and without --hash-cons, and reports the
+# number of expression nodes before and after sharing, the number of
+# instructions generated and the wall time of each run.
+
+set -e
+
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+if [ -n "$1" ]; then
+    cp "$1" "$WORK/input.ks"
+else
+    # identifiers cannot contain digits, so functions are named fa, fb, ...
+    awk 'function name(i,  s) {
+        s = ""
+        do { s = sprintf("%c", 97 + i % 26) s; i = int(i / 26) } while (i > 0)
+        return "f" s
+    }
+    BEGIN {
+        print "extern sin(x);"
+        for (i = 0; i < 200; i++)
+            printf "def %s(x, y) (sin(x * y) + x * y) * (sin(x * y) + x * y) + (x * y + %d) * sin(x * y);\n", name(i), i % 5
+        for (i = 0; i < 2000; i++)
+            printf "%s(%d, 2) + %s(%d, 2) * (1 + 2 * 3);\n", name(i % 200), i, name((i + 1) % 200), i
+    }' > "$WORK/input.ks"
+fi
+
+count_instructions() {
+    # instructions are the indented lines of printed functions
+    grep -c '^  ' "$1" || true
+}
+
+start=$(date +%s.%N)
+"$BIN" < "$WORK/input.ks" > "$WORK/plain.txt" 2>&1
+end=$(date +%s.%N)
+echo "without --hash-cons: $(count_instructions "$WORK/plain.txt") instructions, $(echo "$end - $start" | bc) s"
+
+start=$(date +%s.%N)
+"$BIN" --hash-cons < "$WORK/input.ks" > "$WORK/shared.txt" 2>&1
+end=$(date +%s.%N)
+echo "with --hash-cons:    $(count_instructions "$WORK/shared.txt") instructions, $(echo "$end - $start" | bc) s"
+grep '^Hash-consing:' "$WORK/shared.txt"
@@ -0,0 +1,90 @@
+// Measure the latency of single-character edits to a large document.
+//
+// Usage: obj/bench/incremental.exe [megabytes] [edits]
+//
+// Generates a file of small definitions, then alternately inserts and
+// deletes a character at random places, and reports the latency of
+// Document::edit against tokenizing and parsing the whole text again.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "document.hpp"
+#include "token.hpp"
+
+using namespace kaleidoscope;
+
+namespace {
+
+    typedef std::chrono::steady_clock Clock;
+
+    // identifiers cannot contain digits
+    std::string functionName(size_t i)
+    {
+        std::string name;
+        do {
+            name.insert(name.begin(), static_cast<char>('a' + i % 26));
+            i /= 26;
+        } while (i > 0);
+        return "f" + name;
+    }
+
+    double microseconds(Clock::duration d)
+    {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+}   // anonymous namespace
+
+int main(int argc, char** argv)
+{
+    const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10;
+    const size_t edits = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+
+    std::string text;
+    for (size_t i = 0; text.size() < megabytes * 1024 * 1024; ++i)
+        text += "def " + functionName(i) + "(x, y) x * y + " + std::to_string(i % 97) + " * (x - y);\n";
+
+    // tokens keep a reference to the filename, so it must outlive them
+    const std::string filename("bench");
+    auto start = Clock::now();
+    Document document(filename, text);
+    std::printf("initial parse: %.0f us\n", microseconds(Clock::now() - start));
+
+    start = Clock::now();
+    {
+        std::istringstream stream(document.text());
+        auto tokens = tokenize(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(), filename);
+        auto it = tokens.begin();
+        Diagnostics diagnostics;
+        std::unique_ptr<Node> item;
+        while (parseItem(it, "", diagnostics, &item)) {}
+    }
+    std::printf("full tokenize and parse: %.0f us\n", microseconds(Clock::now() - start));
+
+    std::mt19937 random(42);
+    std::vector<double> latencies;
+    size_t changed = 0;
+    for (size_t i = 0; i < edits; ++i) {
+        const size_t offset = random() % document.text().size();
+        start = Clock::now();
+        const Document::Changes changes = i % 2 == 0
+            ? document.edit(offset, 0, "x")
+            : document.edit(offset, 1, "");
+        latencies.push_back(microseconds(Clock::now() - start));
+        changed += changes.changedDefinitions.size();
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("edit latency: median %.1f us, p99 %.1f us, max %.1f us (%zu definitions changed)\n",
+                latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back(), changed);
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Report what JIT memory management costs on many small modules.
+#
+# Usage: bench/jit_memory.sh [definitions]
+#
+# Compiles DEFS definitions, each in a module of its own, and a call of each,
+# with and without huge pages. Prints the allocator statistics, the wall time
+# and, if strace is installed, the number of mmap and mprotect system calls.
+
+set -e
+
+DEFS=${1:-5000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# identifiers cannot contain digits, so functions are named fa, fb, ...
+awk -v defs="$DEFS" 'function name(i,  s) {
+    s = ""
+    do { s = sprintf("%c", 97 + i % 26) s; i = int(i / 26) } while (i > 0)
+    return "f" s
+}
+BEGIN {
+    for (i = 0; i < defs; i++) {
+        printf "def %s(x) x * %d + 1;\n", name(i), i
+        printf "%s(%d);\n", name(i), i
+    }
+}' > "$WORK/input.ks"
+
+for flags in "" "--jit-huge-pages"; do
+    echo "${flags:-default}:"
+    start=$(date +%s.%N)
+    "$BIN" --emit=none --jit-stats $flags < "$WORK/input.ks" 2>&1 | grep '^JIT memory:'
+    end=$(date +%s.%N)
+    echo "  $(echo "$end - $start" | bc) s"
+    if command -v strace >/dev/null 2>&1; then
+        strace -f -c -e trace=mmap,mprotect,munmap "$BIN" --emit=none $flags < "$WORK/input.ks" 2>&1 >/dev/null \
+            | awk '$NF ~ /^(mmap|mprotect|munmap)$/ { print "  " $NF ": " $4 " calls" }'
+    fi
+done
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Report how evaluation of independent top-level expressions scales with --jobs.
+#
+# Usage: bench/jobs.sh [number-of-expressions] [max-jobs]
+#
+# Generates a script of N independent top-level expressions calling a few
+# definitions, then times kaleidoscope with --jobs=1 up to --jobs=MAX
+# (default: the number of CPUs) and prints the speedup over one job.
+
+set -e
+
+N=${1:-20000}
+MAX=${2:-$(nproc)}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$N" 'BEGIN {
+    print "extern sin(x);"
+    print "extern exp(x);"
+    print "def f(x, y) sin(x) * exp(y) + x * y;"
+    print "def g(x) f(x, 0.5) + f(0.5, x) * f(x, x);"
+    # fixed-point, since the lexer does not read exponents
+    for (i = 1; i <= n; i++)
+        printf "g(%.20f) + f(%d, %.20f);\n", i / n, i % 13, 1 / i
+}' > "$WORK/input.ks"
+
+base=
+jobs=1
+while [ "$jobs" -le "$MAX" ]; do
+    start=$(date +%s.%N)
+    "$BIN" --jobs=$jobs < "$WORK/input.ks" >/dev/null 2>&1
+    end=$(date +%s.%N)
+    t=$(echo "$end - $start" | bc)
+    [ -z "$base" ] && base=$t
+    echo "jobs=$jobs: $t s (x$(echo "scale=2; $base / $t" | bc))"
+    jobs=$((jobs * 2))
+done
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Report where memory goes as the input grows.
+#
+# Usage: bench/memory_profile.sh [definitions...]
+#
+# For each count, generates that many definitions, each called once, and prints
+# the allocations per phase and the peak heap and RSS per byte of input.
+# Bytes per source byte that grow with the count point at memory kept for the
+# whole session rather than per item.
+
+set -e
+
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+[ $# -gt 0 ] || set -- 100 1000 10000
+
+for defs in "$@"; do
+    # identifiers cannot contain digits, so functions are named fa, fb, ...
+    awk -v defs="$defs" 'function name(i,  s) {
+        s = ""
+        do { s = sprintf("%c", 97 + i % 26) s; i = int(i / 26) } while (i > 0)
+        return "f" s
+    }
+    BEGIN {
+        for (i = 0; i < defs; i++) {
+            printf "def %s(x, y) (x * %d + y) * (x < y);\n", name(i), i
+            printf "%s(%d, 1);\n", name(i), i
+        }
+    }' > "$WORK/input.ks"
+
+    echo "$defs definitions, $(wc -c < "$WORK/input.ks") bytes:"
+    "$BIN" --emit=none --memory-profile < "$WORK/input.ks" 2>&1 | sed -n '/^Memory profile:/,$p' | tail -n +2
+done
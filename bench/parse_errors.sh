@@ -0,0 +1,30 @@
+#!/bin/sh
+# Measure throughput on inputs where half of the items are malformed.
+#
+# Usage: bench/parse_errors.sh [number-of-items]
+#
+# Every other line of the generated script has a syntax error (a missing
+# operand, an unbalanced parenthesis or a broken prototype). Prints the
+# wall time and the number of errors reported.
+
+set -e
+
+N=${1:-200000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$N" 'BEGIN {
+    print "def f(x, y) x * y + 1;"
+    for (i = 1; i <= n / 2; i++) {
+        printf "f(%d, 2) + %d;\n", i, i
+        if (i % 3 == 0)      printf "f(%d, ) + 1;\n", i
+        else if (i % 3 == 1) printf "(%d + 2 * ;\n", i
+        else                 printf "def g%d(x y) x;\n", i
+    }
+}' > "$WORK/input.ks"
+
+start=$(date +%s.%N)
+"$BIN" < "$WORK/input.ks" > /dev/null 2> "$WORK/out.txt"
+end=$(date +%s.%N)
+echo "$N items: $(echo "$end - $start" | bc) s, $(grep -c '^stdin:' "$WORK/out.txt") errors"
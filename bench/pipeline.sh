@@ -0,0 +1,41 @@
+#!/bin/sh
+# Compare the sequential driver with --pipeline.
+#
+# Usage: bench/pipeline.sh [items]
+#
+# Generates ITEMS definitions, each followed by a call of it, and prints for
+# both drivers the time until the first result is printed and the total
+# wall time.
+
+set -e
+
+ITEMS=${1:-20000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# identifiers cannot contain digits, so functions are named fa, fb, ...
+awk -v items="$ITEMS" 'function name(i,  s) {
+    s = ""
+    do { s = sprintf("%c", 97 + i % 26) s; i = int(i / 26) } while (i > 0)
+    return "f" s
+}
+BEGIN {
+    for (i = 0; i < items; i++) {
+        printf "def %s(x, y) sum(i = 0, x, i * y + %d) * (x < y);\n", name(i), i
+        printf "%s(%d, 3);\n", name(i), i % 100
+    }
+}' > "$WORK/input.ks"
+
+for flags in "" "--pipeline"; do
+    echo "${flags:-sequential}:"
+    start=$(date +%s.%N)
+    "$BIN" --emit=none $flags < "$WORK/input.ks" 2>&1 >/dev/null | {
+        read -r line
+        first=$(date +%s.%N)
+        cat > /dev/null
+        end=$(date +%s.%N)
+        echo "  first result: $(echo "$first - $start" | bc) s"
+        echo "  total: $(echo "$end - $start" | bc) s"
+    }
+done
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Compare the reduction builtins with the same sums written out by hand.
+#
+# Usage: bench/reduction.sh [terms] [evaluations]
+#
+# The language has no conditionals, so a recursive sum can never stop;
+# the only loop-free alternative to sum(...) is to spell out every term.
+# For each form, evaluates sum_{i < TERMS} sin(i) * i REPEAT times and
+# reports the wall time. Run with --fp-mode=fast (the default here) so
+# that the floating-point reductions may be reassociated and vectorized.
+
+set -e
+
+TERMS=${1:-1000}
+REPEAT=${2:-1000}
+MODE=${MODE:-fast}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v terms="$TERMS" -v repeat="$REPEAT" 'BEGIN {
+    print "extern sin(x);"
+    printf "def f(n) sum(i = 0, n, sin(i) * i);\n"
+    for (r = 0; r < repeat; r++)
+        printf "f(%d);\n", terms
+}' > "$WORK/loop.ks"
+
+awk -v terms="$TERMS" -v repeat="$REPEAT" 'BEGIN {
+    print "extern sin(x);"
+    printf "def f(n) 0"
+    for (i = 0; i < terms; i++)
+        printf " + sin(%d) * %d", i, i
+    print ";"
+    for (r = 0; r < repeat; r++)
+        printf "f(%d);\n", terms
+}' > "$WORK/unrolled.ks"
+
+for form in loop unrolled; do
+    start=$(date +%s.%N)
+    "$BIN" --fp-mode=$MODE --mcpu=native < "$WORK/$form.ks" >/dev/null 2>&1
+    end=$(date +%s.%N)
+    echo "$form: $(echo "$end - $start" | bc) s"
+done
@@ -0,0 +1,71 @@
+#!/bin/sh
+# Check that memory stays flat while evaluating many top-level expressions.
+#
+# Usage: bench/soak.sh [number-of-expressions]
+#
+# Streams N top-level expressions, each with literals of its own, into
+# kaleidoscope --pipeline, which does not keep the tokens of the whole input,
+# and prints its resident set size once a second. Then compares the peak heap
+# reported by --memory-profile with that of a run of N/2 expressions, and fails
+# if it grew by more than 10%: memory that levels off does not depend on the
+# length of the input. Does both without and with --hash-cons. The verdict uses the heap rather than the RSS, which
+# swings by megabytes as malloc returns memory to the system.
+#
+# Needs a build without AddressSanitizer, whose quarantine holds freed memory
+# back and hides the trend:  make clean && make SANITIZE=
+
+set -e
+
+N=${1:-20000}
+BIN=${BIN:-./kaleidoscope}
+
+if grep -q __asan_init "$BIN"; then
+    echo "$BIN is built with AddressSanitizer; rebuild it with: make clean && make SANITIZE=" >&2
+    exit 2
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+generate() {
+    awk -v n="$1" 'BEGIN {
+        print "def f(x, y) x * y + x;"
+        for (i = 1; i <= n; i++)
+            printf "f(%d, %d) + %d;\n", i, i + 1, i % 7
+    }'
+}
+
+peak_heap() {
+    awk '/peak heap:/ { sub(/,$/, "", $3); print $3 }' "$1"
+}
+
+# soak FLAGS...: run N/2 and then N expressions with the given options and compare
+soak() {
+    generate $((N / 2)) | "$BIN" --pipeline --emit=none --memory-profile "$@" >/dev/null 2> "$WORK/half.txt"
+
+    generate "$N" | "$BIN" --pipeline --emit=none --memory-profile "$@" >/dev/null 2> "$WORK/full.txt" &
+    pid=$!
+    elapsed=0
+    while kill -0 "$pid" 2>/dev/null; do
+        rss=$(awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status" 2>/dev/null || true)
+        [ -n "$rss" ] && echo "${elapsed}s ${rss} kB"
+        sleep 1
+        elapsed=$((elapsed + 1))
+    done
+    wait "$pid"
+
+    half=$(peak_heap "$WORK/half.txt")
+    full=$(peak_heap "$WORK/full.txt")
+    echo "peak heap: $half bytes after $((N / 2)) expressions, $full bytes after $N"
+    if [ "$full" -gt $((half + half / 10)) ]; then
+        echo "FAIL: memory grows with the number of expressions"
+        exit 1
+    fi
+}
+
+echo "plain:"
+soak
+# the hash-consing table must not keep nodes of earlier items either
+echo "--hash-cons:"
+soak --hash-cons
+echo "OK: memory is flat"
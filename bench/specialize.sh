@@ -0,0 +1,28 @@
+#!/bin/sh
+# Compare evaluation with and without specialization for constant arguments.
+#
+# Usage: bench/specialize.sh [evaluations]
+#
+# Evaluates a reduction whose bounds and scale are passed as constants
+# REPEAT times. Specialized, the trip count is known at compile time,
+# so the loop can be unrolled and vectorized without a remainder.
+
+set -e
+
+REPEAT=${1:-1000}
+BIN=${BIN:-./kaleidoscope}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v repeat="$REPEAT" 'BEGIN {
+    print "def f(n, k, x) sum(i = 0, n, (i * k + x) * (i * k - x));"
+    for (r = 0; r < repeat; r++)
+        printf "f(64, 0.5, %d);\n", r
+}' > "$WORK/input.ks"
+
+for flags in "" "--specialize=2"; do
+    start=$(date +%s.%N)
+    "$BIN" --fp-mode=fast $flags < "$WORK/input.ks" >/dev/null 2>&1
+    end=$(date +%s.%N)
+    echo "${flags:-generic}: $(echo "$end - $start" | bc) s"
+done
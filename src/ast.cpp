@@ -1,7 +1,28 @@
+#include <algorithm>
 #include <cassert>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/raw_os_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 #include "ast.hpp"
+#include "diagnostics.hpp"
+#include "expr_table.hpp"
+#include "jit.hpp"
+#include "memory_profile.hpp"
+#include "profile.hpp"
+#include "specializer.hpp"
+#include "spsc_queue.hpp"
+#include "thread_pool.hpp"
 #include "token.hpp"
 
 namespace {
@@ -9,41 +30,106 @@ namespace {
     using namespace kaleidoscope;
     typedef std::vector<std::unique_ptr<Token>>::iterator Iter;
 
-    std::unique_ptr<ExprNode> parseNumberExpr(Iter& it)
+    // Prefix of the names of the functions which wrap top-level expressions.
+    const char* const kAnonymousExprName = "__anon_expr";
+
+    // Maximum number of top-level expressions compiled and evaluated together.
+    const size_t kMaxPendingExprs = 4096;
+
+    std::string anonymousExprName(size_t index)
+    {
+        return kAnonymousExprName + std::to_string(index);
+    }
+
+    // Returns the intrinsic which computes the libm function `name` taking `argCount` doubles,
+    // or llvm::Intrinsic::not_intrinsic if there is none.
+    llvm::Intrinsic::ID getMathIntrinsic(const std::string& name, size_t argCount, FloatingPointMode fpMode)
+    {
+        static const struct {
+            const char* name;
+            size_t argCount;
+            llvm::Intrinsic::ID id;
+        } table[] = {
+            { "sin",       1, llvm::Intrinsic::sin },
+            { "cos",       1, llvm::Intrinsic::cos },
+            { "exp",       1, llvm::Intrinsic::exp },
+            { "exp2",      1, llvm::Intrinsic::exp2 },
+            { "log",       1, llvm::Intrinsic::log },
+            { "log2",      1, llvm::Intrinsic::log2 },
+            { "log10",     1, llvm::Intrinsic::log10 },
+            { "fabs",      1, llvm::Intrinsic::fabs },
+            { "floor",     1, llvm::Intrinsic::floor },
+            { "ceil",      1, llvm::Intrinsic::ceil },
+            { "trunc",     1, llvm::Intrinsic::trunc },
+            { "round",     1, llvm::Intrinsic::round },
+            { "rint",      1, llvm::Intrinsic::rint },
+            { "nearbyint", 1, llvm::Intrinsic::nearbyint },
+            { "pow",       2, llvm::Intrinsic::pow },
+            { "copysign",  2, llvm::Intrinsic::copysign },
+            { "fmin",      2, llvm::Intrinsic::minnum },
+            { "fmax",      2, llvm::Intrinsic::maxnum },
+            { "fma",       3, llvm::Intrinsic::fma },
+        };
+
+        for (const auto& entry : table) {
+            if (name == entry.name && argCount == entry.argCount)
+                return entry.id;
+        }
+
+        // llvm.sqrt is undefined for negative numbers while sqrt returns NaN
+        if (name == "sqrt" && argCount == 1 && fpMode == FloatingPointMode::Fast)
+            return llvm::Intrinsic::sqrt;
+
+        return llvm::Intrinsic::not_intrinsic;
+    }
+
+    // Record an error. Returns nullptr so that parsers can `return fail(...)`.
+    std::nullptr_t fail(Diagnostics& diagnostics, const Position& position, const char* message)
+    {
+        diagnostics.report(position, message);
+        return nullptr;
+    }
+
+    std::unique_ptr<ExprNode> parseNumberExpr(Iter& it, Diagnostics& diagnostics)
     {
         const NumberToken* t = dynamic_cast<NumberToken*>(it->get());
         if (!t)
-            throw ParseError((*it)->position(), "extected number");
+            return fail(diagnostics, (*it)->position(), "extected number");
         ++it;
         return std::unique_ptr<NumberExprNode>(new NumberExprNode(t->position(), t->number()));
     }
 
-    std::unique_ptr<ExprNode> parseParenExpr(Iter& it)
+    std::unique_ptr<ExprNode> parseParenExpr(Iter& it, Diagnostics& diagnostics)
     {
         const CharToken* t1 = dynamic_cast<CharToken*>(it->get());
         if (!t1 || t1->ch() != '(')
-            throw ParseError((*it)->position(), "expected '('");
+            return fail(diagnostics, (*it)->position(), "expected '('");
         ++it;
 
-        std::unique_ptr<ExprNode> ret = parseExpr(it);
+        std::unique_ptr<ExprNode> ret = parseExpr(it, diagnostics);
+        if (!ret)
+            return nullptr;
 
         const CharToken* t2 = dynamic_cast<CharToken*>(it->get());
         if (!t2 || t2->ch() != ')')
-            throw ParseError((*it)->position(), "expected ')'");
+            return fail(diagnostics, (*it)->position(), "expected ')'");
         ++it;
 
         return std::move(ret);
     }
 
-    std::unique_ptr<ExprNode> parseFunctionCall(Iter& it, const Position& position, const std::string& funcName)
+    std::unique_ptr<ExprNode> parseFunctionCall(Iter& it, const Position& position, const std::string& funcName,
+                                                Diagnostics& diagnostics)
     {
         std::vector<std::unique_ptr<ExprNode>> args;
         for (;;) {
-            args.push_back(parseExpr(it));
+            args.push_back(parseExpr(it, diagnostics));
+            if (!args.back())
+                return nullptr;
 
             const CharToken* token = dynamic_cast<CharToken*>(it->get());
             if (!token || (token->ch() != ')' && token->ch() != ','))
-                throw ParseError((*it)->position(), "expected ')' or ',' in argument list");
+                return fail(diagnostics, (*it)->position(), "expected ')' or ',' in argument list");
             ++it;
             if (token->ch() == ')')
                 break;
@@ -52,36 +138,92 @@ namespace {
         return std::unique_ptr<CallExprNode>(new CallExprNode(position, funcName, std::move(args)));
     }
 
-    std::unique_ptr<ExprNode> parseIdentifierExpr(Iter& it)
+    // Returns true and sets `kind` if `name` names a reduction and the tokens
+    // at `it` (just after the '(') look like "identifier =".
+    bool isReduction(const std::string& name, Iter it, ReductionExprNode::Kind* kind)
+    {
+        if (name == "sum") {
+            *kind = ReductionExprNode::Sum;
+        } else if (name == "product") {
+            *kind = ReductionExprNode::Product;
+        } else if (name == "min") {
+            *kind = ReductionExprNode::Min;
+        } else if (name == "max") {
+            *kind = ReductionExprNode::Max;
+        } else {
+            return false;
+        }
+
+        if (!dynamic_cast<IdentifierToken*>(it->get()))
+            return false;
+        const CharToken* t = dynamic_cast<CharToken*>((it + 1)->get());
+        return t && t->ch() == '=';
+    }
+
+    // Parse the part of a reduction after '(': "identifier = start, end, body)".
+    std::unique_ptr<ExprNode> parseReduction(Iter& it, const Position& position, ReductionExprNode::Kind kind,
+                                             Diagnostics& diagnostics)
+    {
+        const IdentifierToken* t1 = dynamic_cast<IdentifierToken*>(it->get());
+        if (!t1)
+            return fail(diagnostics, (*it)->position(), "expected index variable in reduction");
+        ++it;
+
+        const CharToken* t2 = dynamic_cast<CharToken*>(it->get());
+        if (!t2 || t2->ch() != '=')
+            return fail(diagnostics, (*it)->position(), "expected '=' in reduction");
+        ++it;
+
+        std::shared_ptr<const ExprNode> operands[3];
+        for (int i = 0; i < 3; ++i) {
+            operands[i] = parseExpr(it, diagnostics);
+            if (!operands[i])
+                return nullptr;
+
+            const char expected = i < 2 ? ',' : ')';
+            const CharToken* t3 = dynamic_cast<CharToken*>(it->get());
+            if (!t3 || t3->ch() != expected)
+                return fail(diagnostics, (*it)->position(), i < 2 ? "expected ',' in reduction" : "expected ')' in reduction");
+            ++it;
+        }
+
+        return std::unique_ptr<ReductionExprNode>(new ReductionExprNode(
+                position, kind, t1->name(), operands[0], operands[1], operands[2]));
+    }
+
+    std::unique_ptr<ExprNode> parseIdentifierExpr(Iter& it, Diagnostics& diagnostics)
     {
         const IdentifierToken* t1 = dynamic_cast<IdentifierToken*>(it->get());
         if (!t1)
-            throw ParseError((*it)->position(), "expected identifier");
+            return fail(diagnostics, (*it)->position(), "expected identifier");
         ++it;
 
         if (const CharToken* t2 = dynamic_cast<CharToken*>(it->get())) {
             if (t2->ch() == '(') {
                 ++it;
-                return parseFunctionCall(it, t1->position(), t1->name());
+                ReductionExprNode::Kind kind;
+                if (isReduction(t1->name(), it, &kind))
+                    return parseReduction(it, t1->position(), kind, diagnostics);
+                return parseFunctionCall(it, t1->position(), t1->name(), diagnostics);
             }
         }
 
         return std::unique_ptr<VariableExprNode>(new VariableExprNode(t1->position(), t1->name()));
     }
 
-    std::unique_ptr<ExprNode> parsePrimary(Iter& it)
+    std::unique_ptr<ExprNode> parsePrimary(Iter& it, Diagnostics& diagnostics)
     {
         if (dynamic_cast<IdentifierToken*>(it->get()))
-            return parseIdentifierExpr(it);
+            return parseIdentifierExpr(it, diagnostics);
 
         if (dynamic_cast<NumberToken*>(it->get()))
-            return parseNumberExpr(it);
+            return parseNumberExpr(it, diagnostics);
 
         if (const CharToken* t = dynamic_cast<CharToken*>(it->get()))
             if (t->ch() == '(')
-                return parseParenExpr(it);
+                return parseParenExpr(it, diagnostics);
 
-        throw ParseError((*it)->position(), "unknown token when expecting an expression");
+        return fail(diagnostics, (*it)->position(), "unknown token when expecting an expression");
     }
 
     int getPrecedence(const CharToken* token)
@@ -97,7 +239,8 @@ namespace {
         return -1;
     }
 
-    std::unique_ptr<ExprNode> parseBinaryExprRhs(Iter& it, int minPrecedence, std::unique_ptr<ExprNode> lhs)
+    std::unique_ptr<ExprNode> parseBinaryExprRhs(Iter& it, int minPrecedence, std::unique_ptr<ExprNode> lhs,
+                                                 Diagnostics& diagnostics)
     {
         const CharToken* t1 = dynamic_cast<CharToken*>(it->get());
         int precedence1 = getPrecedence(t1);
@@ -106,32 +249,36 @@ namespace {
         const Operator op = t1->ch();
         ++it;
 
-        auto rhs1 = parsePrimary(it);
+        auto rhs1 = parsePrimary(it, diagnostics);
+        if (!rhs1)
+            return nullptr;
 
         const CharToken* t2 = dynamic_cast<CharToken*>(it->get());
         const int precedence2 = getPrecedence(t2);
         if (precedence1 >= precedence2) {
             auto lhs2 = std::unique_ptr<BinaryExprNode>(
                 new BinaryExprNode(t1->position(), op, std::move(lhs), std::move(rhs1)));
-            return parseBinaryExprRhs(it, minPrecedence, std::move(lhs2));
+            return parseBinaryExprRhs(it, minPrecedence, std::move(lhs2), diagnostics);
         } else {
-            auto rhs2 = parseBinaryExprRhs(it, precedence1 + 1, std::move(rhs1));
+            auto rhs2 = parseBinaryExprRhs(it, precedence1 + 1, std::move(rhs1), diagnostics);
+            if (!rhs2)
+                return nullptr;
             auto lhs2 = std::unique_ptr<BinaryExprNode>(
                 new BinaryExprNode(t1->position(), op, std::move(lhs), std::move(rhs2)));
-            return parseBinaryExprRhs(it, minPrecedence, std::move(lhs2));
+            return parseBinaryExprRhs(it, minPrecedence, std::move(lhs2), diagnostics);
         }
     }
 
-    std::unique_ptr<PrototypeNode> parsePrototype(Iter& it)
+    std::unique_ptr<PrototypeNode> parsePrototype(Iter& it, Diagnostics& diagnostics)
     {
         const IdentifierToken* t1 = dynamic_cast<IdentifierToken*>(it->get());
         if (!t1)
-            throw ParseError((*it)->position(), "expected function name in prototype");
+            return fail(diagnostics, (*it)->position(), "expected function name in prototype");
         ++it;
 
         const CharToken* t2 = dynamic_cast<CharToken*>(it->get());
         if (!t2 || t2->ch() != '(')
-            throw ParseError((*it)->position(), "expected '(' in prototype");
+            return fail(diagnostics, (*it)->position(), "expected '(' in prototype");
         ++it;
 
         std::vector<std::string> args;
@@ -147,59 +294,684 @@ namespace {
 
         const CharToken* t5 = dynamic_cast<CharToken*>(it->get());
         if (!t5 || t5->ch() != ')')
-            throw ParseError((*it)->position(), "expected ')' in prototype");
+            return fail(diagnostics, (*it)->position(), "expected ')' in prototype");
         ++it;
 
         return std::unique_ptr<PrototypeNode>(new PrototypeNode(t1->position(), t1->name(), std::move(args)));
     }
 
-    std::unique_ptr<FunctionNode> parseDefinition(Iter& it)
+    // If `specializer` is not null, calls with constant arguments are rewritten with it.
+    // If `table` is not null, the body is hash-consed with it.
+    std::unique_ptr<FunctionNode> parseDefinition(Iter& it, Specializer* specializer, ExprTable* table,
+                                                  Diagnostics& diagnostics)
     {
+        const PhaseScope phase(Phase::Parse);
         const DefToken* t1 = dynamic_cast<DefToken*>(it->get());
         if (!t1)
-            throw ParseError((*it)->position(), "expected 'def'");
+            return fail(diagnostics, (*it)->position(), "expected 'def'");
         ++it;
-        auto proto = parsePrototype(it);
-        auto body = parseExpr(it);
+        auto proto = parsePrototype(it, diagnostics);
+        if (!proto)
+            return nullptr;
+        std::shared_ptr<const ExprNode> body = parseExpr(it, diagnostics);
+        if (!body)
+            return nullptr;
+        if (specializer)
+            body = specializer->rewrite(proto->name(), *body);
+        if (table)
+            body = table->intern(*body);
         return std::unique_ptr<FunctionNode>(new FunctionNode(std::move(proto), std::move(body)));
     }
 
-    std::unique_ptr<PrototypeNode> parseExtern(Iter& it)
+    std::unique_ptr<PrototypeNode> parseExtern(Iter& it, Diagnostics& diagnostics)
     {
+        const PhaseScope phase(Phase::Parse);
         const ExternToken* t1 = dynamic_cast<ExternToken*>(it->get());
         if (!t1)
-            throw ParseError((*it)->position(), "expected 'extern'");
+            return fail(diagnostics, (*it)->position(), "expected 'extern'");
         ++it;
-        return parsePrototype(it);
+        return parsePrototype(it, diagnostics);
     }
 
-    std::unique_ptr<FunctionNode> parseTopLevelExpr(Iter& it)
+    // If `specializer` is not null, calls with constant arguments are rewritten with it.
+    // If `table` is not null, the expression is hash-consed with it.
+    std::unique_ptr<FunctionNode> parseTopLevelExpr(Iter& it, const std::string& name, Specializer* specializer,
+                                                    ExprTable* table, Diagnostics& diagnostics)
     {
+        const PhaseScope phase(Phase::Parse);
         const Position& pos = (*it)->position();
-        auto expr = parseExpr(it);
-        auto proto = std::unique_ptr<PrototypeNode>(new PrototypeNode(pos, "", std::vector<std::string>()));
+        std::shared_ptr<const ExprNode> expr = parseExpr(it, diagnostics);
+        if (!expr)
+            return nullptr;
+        if (specializer)
+            expr = specializer->rewrite(name, *expr);
+        if (table)
+            expr = table->intern(*expr);
+        auto proto = std::unique_ptr<PrototypeNode>(new PrototypeNode(pos, name, std::vector<std::string>()));
         return std::unique_ptr<FunctionNode>(new FunctionNode(std::move(proto), std::move(expr)));
     }
 
-    bool parseOneAndPrint(Iter& it, Context& context)
+    // Skip tokens up to and including the next ';', or up to the end of file.
+    void skipToNextItem(Iter& it)
+    {
+        for (;;) {
+            if (dynamic_cast<EofToken*>(it->get()))
+                return;
+            const CharToken* t = dynamic_cast<CharToken*>(it->get());
+            ++it;
+            if (t && t->ch() == ';')
+                return;
+        }
+    }
+
+    // Write `node` as an S-expression, e.g. "(+ x (call foo y 4))".
+    void printAst(std::ostream& out, const ExprNode& node)
+    {
+        if (auto n = dynamic_cast<const NumberExprNode*>(&node)) {
+            out << n->value();
+        } else if (auto n = dynamic_cast<const VariableExprNode*>(&node)) {
+            out << n->name();
+        } else if (auto n = dynamic_cast<const BinaryExprNode*>(&node)) {
+            out << '(' << static_cast<char>(n->op()) << ' ';
+            printAst(out, *n->lhs());
+            out << ' ';
+            printAst(out, *n->rhs());
+            out << ')';
+        } else if (auto n = dynamic_cast<const CallExprNode*>(&node)) {
+            out << "(call " << n->callee();
+            for (size_t i = 0; i < n->argumentCount(); ++i) {
+                out << ' ';
+                printAst(out, *n->argument(i));
+            }
+            out << ')';
+        } else if (auto n = dynamic_cast<const ReductionExprNode*>(&node)) {
+            static const char* const names[] = { "sum", "product", "min", "max" };
+            out << '(' << names[n->kind()] << ' ' << n->variable() << ' ';
+            printAst(out, *n->start());
+            out << ' ';
+            printAst(out, *n->end());
+            out << ' ';
+            printAst(out, *n->body());
+            out << ')';
+        }
+    }
+
+    // Write `proto` as "(name arg...)".
+    void printAst(std::ostream& out, const PrototypeNode& proto)
+    {
+        out << '(' << proto.name();
+        for (size_t i = 0; i < proto.argumentCount(); ++i)
+            out << ' ' << proto.argument(i);
+        out << ')';
+    }
+
+    void printFunction(std::ostream& out, const llvm::Function* func)
+    {
+        llvm::raw_os_ostream stream(out);
+        func->print(stream);
+    }
+
+    size_t countInstructions(const llvm::Function* func)
+    {
+        size_t count = 0;
+        for (const auto& block : *func)
+            count += block.size();
+        return count;
+    }
+
+    // State shared by all the items read from one input.
+    struct Session {
+        Session(const Options& options, llvm::LLVMContext& llvmContext, std::ostream& out, std::ostream& emit):
+            options(options),
+            llvmContext(&llvmContext),
+            ownedLlvmContext(),
+            exprsInLlvmContext(0),
+            out(out),
+            outMutex(),
+            emit(emit),
+            profile(),
+            context(new llvm::Module("my module", llvmContext), llvmContext,
+                    options.fpMode, options.profile ? &profile : nullptr),
+            jit(options),
+            externs(),
+            definitions(),
+            reoptimized(),
+            linkable(),
+            pure(),
+            specializer(options.specializeThreshold > 0
+                        ? new Specializer(definitions, options.specializeThreshold, options.specializeBudget)
+                        : nullptr),
+            diagnostics(),
+            pool(options.jobs > 1 ? new ThreadPool(options.jobs) : nullptr),
+            pendingExprs(0),
+            pendingForeignCalls(false),
+            exprTable(options.hashCons ? new ExprTable() : nullptr),
+            instructionCount(0),
+            emitted(options.emit == EmitMode::LlvmIr || options.emit == EmitMode::Bitcode ||
+                    options.emit == EmitMode::Object ? new llvm::Module("kaleidoscope", llvmContext) : nullptr),
+            emittedExprs(0) {}
+
+        const Options& options;
+
+        // context of the IR under construction: the caller's at first, then one owned by
+        // the session once recycleLlvmContext() has replaced it
+        llvm::LLVMContext* llvmContext;
+        std::unique_ptr<llvm::LLVMContext> ownedLlvmContext;
+
+        // number of top-level expressions compiled in `llvmContext`
+        size_t exprsInLlvmContext;
+
+        // results and diagnostics
+        std::ostream& out;
+
+        // held while writing to `out` from the stages of a pipeline which may run concurrently
+        std::mutex outMutex;
+
+        // output selected by options.emit
+        std::ostream& emit;
+
+        Profile profile;
+        Context context;
+        Jit jit;
+
+        // ASTs kept to recompile hot functions
+        std::vector<std::unique_ptr<PrototypeNode>> externs;
+        std::map<std::string, std::unique_ptr<FunctionNode>> definitions;
+
+        // names of the functions which have already been recompiled
+        std::set<std::string> reoptimized;
+
+        // definitions whose calls are known to link; cleared when a definition changes
+        std::set<std::string> linkable;
+
+        // definitions known to run only Kaleidoscope code; cleared when a definition changes
+        std::set<std::string> pure;
+
+        // clones functions for constant arguments; null unless specialization is enabled
+        std::unique_ptr<Specializer> specializer;
+
+        // errors found while reading the input, printed at its end
+        Diagnostics diagnostics;
+
+        // evaluates top-level expressions in parallel; null for sequential evaluation
+        std::unique_ptr<ThreadPool> pool;
+
+        // number of top-level expressions compiled into the current module
+        // but not evaluated yet
+        size_t pendingExprs;
+
+        // set if one of the pending expressions may call an extern with side effects,
+        // in which case they are evaluated one after another even with a thread pool
+        bool pendingForeignCalls;
+
+        // shares identical subexpressions; null unless hash-consing is enabled
+        std::unique_ptr<ExprTable> exprTable;
+
+        // number of instructions generated for definitions and top-level expressions
+        size_t instructionCount;
+
+        // copies of every module given to the JIT, linked together;
+        // null unless a whole module is to be emitted
+        std::unique_ptr<llvm::Module> emitted;
+
+        // number of top-level expressions in `emitted`
+        size_t emittedExprs;
+    };
+
+    // Link a copy of `module`, which is about to be given to the JIT, into `session.emitted`.
+    // Top-level expressions are renumbered, and earlier definitions of redefined
+    // functions are renamed and made internal so that code already linked still calls them.
+    void emitModule(Session& session, const llvm::Module& module)
+    {
+        if (!session.emitted)
+            return;
+
+        std::unique_ptr<llvm::Module> copy = llvm::CloneModule(&module);
+        std::vector<llvm::Function*> exprs;
+        for (llvm::Function& f : *copy) {
+            if (f.isDeclaration())
+                continue;
+            if (f.getName().startswith(kAnonymousExprName)) {
+                exprs.push_back(&f);
+                continue;
+            }
+            llvm::Function* old = session.emitted->getFunction(f.getName());
+            if (old && !old->isDeclaration()) {
+                old->setName(f.getName() + ".old");
+                old->setLinkage(llvm::Function::InternalLinkage);
+            }
+        }
+
+        // drop the names first, since a new name may still be taken by another expression
+        for (llvm::Function* f : exprs)
+            f->setName("");
+        for (llvm::Function* f : exprs)
+            f->setName(anonymousExprName(session.emittedExprs++));
+
+        llvm::Linker::linkModules(*session.emitted, std::move(copy));
+    }
+
+    // Write `session.emitted` to `session.emit` in the format selected by the options.
+    void writeEmittedModule(Session& session)
+    {
+        llvm::Module& module = *session.emitted;
+        switch (session.options.emit) {
+        case EmitMode::LlvmIr: {
+            llvm::raw_os_ostream stream(session.emit);
+            module.print(stream, nullptr);
+            break;
+        }
+        case EmitMode::Bitcode: {
+            llvm::raw_os_ostream stream(session.emit);
+            llvm::WriteBitcodeToFile(&module, stream);
+            break;
+        }
+        case EmitMode::Object:
+            if (!session.jit.emitObject(module, session.emit))
+                session.out << "The target cannot emit object files" << std::endl;
+            break;
+        default:
+            break;
+        }
+        session.emit.flush();
+    }
+
+    // Call `f` for every call in `node`.
+    void forEachCall(const ExprNode& node, const std::function<void(const CallExprNode&)>& f)
+    {
+        if (auto n = dynamic_cast<const BinaryExprNode*>(&node)) {
+            forEachCall(*n->lhs(), f);
+            forEachCall(*n->rhs(), f);
+        } else if (auto n = dynamic_cast<const CallExprNode*>(&node)) {
+            for (size_t i = 0; i < n->argumentCount(); ++i)
+                forEachCall(*n->argument(i), f);
+            f(*n);
+        } else if (auto n = dynamic_cast<const ReductionExprNode*>(&node)) {
+            forEachCall(*n->start(), f);
+            forEachCall(*n->end(), f);
+            forEachCall(*n->body(), f);
+        }
+    }
+
+    // Returns the name of a function which a call to `name` needs, directly or through
+    // the bodies of definitions, and which the JIT cannot link: one declared by `extern`,
+    // never defined, and neither computed by an intrinsic nor found in the process.
+    // Returns an empty string if there is none. `visited` holds the definitions followed.
+    std::string findUnlinkable(Session& session, const std::string& name, size_t argCount,
+                               std::set<std::string>* visited)
+    {
+        const auto definition = session.definitions.find(name);
+        if (definition == session.definitions.end()) {
+            // calls to undeclared functions are reported by code generation
+            if (!session.context.isDeclared(name) ||
+                    getMathIntrinsic(name, argCount, session.options.fpMode) != llvm::Intrinsic::not_intrinsic ||
+                    session.jit.hasProcessSymbol(name))
+                return std::string();
+            return name;
+        }
+
+        if (session.linkable.count(name) || !visited->insert(name).second)
+            return std::string();
+        std::string missing;
+        forEachCall(*definition->second->body(), [&](const CallExprNode& call) {
+            if (missing.empty())
+                missing = findUnlinkable(session, call.callee(), call.argumentCount(), visited);
+        });
+        return missing;
+    }
+
+    // Throw a CodegenError at the first call in `body`, a top-level expression, which
+    // the JIT could not link. Definitions are linked lazily, when an expression first
+    // needs them, and the object layer then aborts the process on a missing function
+    // instead of reporting it, so such calls are rejected before any code is generated.
+    void checkCallsLink(Session& session, const ExprNode& body)
+    {
+        forEachCall(body, [&](const CallExprNode& call) {
+            std::set<std::string> visited;
+            const std::string missing = findUnlinkable(session, call.callee(), call.argumentCount(), &visited);
+            if (!missing.empty())
+                throw CodegenError(call.position(), "unresolved function referenced: " + missing);
+            // only a finished search is conclusive; one inside a cycle may not be
+            if (session.definitions.count(call.callee()))
+                session.linkable.insert(call.callee());
+        });
+    }
+
+    // Returns true if a call to `name` may run code which is not Kaleidoscope, directly
+    // or through the bodies of definitions: a function declared by `extern` and not
+    // computed by an intrinsic, which may have side effects. `visited` holds the
+    // definitions followed.
+    bool callsForeignCode(Session& session, const std::string& name, size_t argCount,
+                          std::set<std::string>* visited)
+    {
+        const auto definition = session.definitions.find(name);
+        if (definition == session.definitions.end()) {
+            return session.context.isDeclared(name) &&
+                   getMathIntrinsic(name, argCount, session.options.fpMode) == llvm::Intrinsic::not_intrinsic;
+        }
+
+        if (session.pure.count(name) || !visited->insert(name).second)
+            return false;
+        bool foreign = false;
+        forEachCall(*definition->second->body(), [&](const CallExprNode& call) {
+            foreign = foreign || callsForeignCode(session, call.callee(), call.argumentCount(), visited);
+        });
+        return foreign;
+    }
+
+    // Returns true if `body`, a top-level expression, may run code which is not Kaleidoscope.
+    bool isPure(Session& session, const ExprNode& body)
+    {
+        bool pure = true;
+        forEachCall(body, [&](const CallExprNode& call) {
+            if (!pure)
+                return;
+            std::set<std::string> visited;
+            pure = !callsForeignCode(session, call.callee(), call.argumentCount(), &visited);
+            // only a finished search is conclusive; one inside a cycle may not be
+            if (pure && session.definitions.count(call.callee()))
+                session.pure.insert(call.callee());
+        });
+        return pure;
+    }
+
+    // Recompile the functions called at least `hotThreshold` times.
+    // They are compiled without instrumentation, annotated with their entry counts,
+    // and together with private copies of every other definition so that
+    // callees can be inlined aggressively. The new code hides the old one for
+    // everything compiled afterwards.
+    void reoptimizeHotFunctions(Session& session)
+    {
+        std::vector<std::string> hot;
+        for (const auto& definition : session.definitions) {
+            const std::string& name = definition.first;
+            if (!session.reoptimized.count(name) &&
+                    session.profile.count("entry " + name) >= session.options.hotThreshold)
+                hot.push_back(name);
+        }
+        if (hot.empty())
+            return;
+
+        Context context(new llvm::Module("hot module", *session.llvmContext), *session.llvmContext,
+                        session.options.fpMode);
+
+        try {
+            for (const auto& proto : session.externs) {
+                if (!session.definitions.count(proto->name()))
+                    proto->Codegen(context);
+            }
+            for (const auto& definition : session.definitions) {
+                definition.second->prototype()->Codegen(context);
+                context.define(definition.first);
+            }
+            for (const auto& definition : session.definitions) {
+                // a definition the JIT cannot link would abort linking the whole module;
+                // hot functions never call one, since they have run
+                const std::string& name = definition.first;
+                std::set<std::string> visited;
+                if (!findUnlinkable(session, name, definition.second->prototype()->argumentCount(), &visited).empty())
+                    continue;
+                llvm::Function* f = definition.second->Codegen(context);
+                f->setEntryCount(session.profile.count("entry " + name));
+                if (std::find(hot.begin(), hot.end(), name) == hot.end())
+                    f->setLinkage(llvm::Function::InternalLinkage);
+            }
+        } catch (const CodegenError& e) {
+            std::lock_guard<std::mutex> lock(session.outMutex);
+            session.out << "Failed to reoptimize hot functions: " << e.what() << std::endl;
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(session.outMutex);
+            for (const auto& name : hot)
+                session.out << "Reoptimizing hot function: " << name << std::endl;
+        }
+        session.reoptimized.insert(hot.begin(), hot.end());
+        session.jit.addDefinitions(context.takeModule(nullptr), hot, JitMemory::Hot);
+    }
+
+    // An LLVMContext never frees the constants and types created in it, and every
+    // top-level expression brings its own literals, so a long session moves to a
+    // fresh context after this many expressions.
+    const size_t kExprsPerLlvmContext = 4096;
+
+    // Continue in a new LLVMContext and free the old one if the session owns it.
+    // Must be called between items, once the module under construction is empty:
+    // the JIT has compiled every earlier module to machine code, and nothing but
+    // `session.context` and `session.emitted` keeps IR. Not done while a whole
+    // module is emitted, since `session.emitted` must stay in one context.
+    void recycleLlvmContext(Session& session)
+    {
+        session.exprsInLlvmContext = 0;
+        if (session.emitted)
+            return;
+
+        std::unique_ptr<llvm::LLVMContext> llvmContext(new llvm::LLVMContext());
+        session.context.resetModule(new llvm::Module("my module", *llvmContext));
+        session.llvmContext = llvmContext.get();
+        session.ownedLlvmContext = std::move(llvmContext);
+    }
+
+    // Top-level expressions compiled together into one module.
+    struct ExprBatch {
+        Jit::ModuleHandle handle;
+        std::vector<double (*)()> functions;
+        // set if the functions must not run concurrently, see Session::pendingForeignCalls
+        bool sequential;
+    };
+
+    // Compile the pending top-level expressions as one module.
+    // Returns a batch without functions if there are none.
+    ExprBatch compilePendingExprs(Session& session)
+    {
+        ExprBatch batch = ExprBatch();
+        const size_t count = session.pendingExprs;
+        if (count == 0)
+            return batch;
+        session.pendingExprs = 0;
+        batch.sequential = session.pendingForeignCalls;
+        session.pendingForeignCalls = false;
+
+        auto module = session.context.takeModule(new llvm::Module("my module", *session.llvmContext));
+        emitModule(session, *module);
+        batch.handle = session.jit.addModule(std::move(module), JitMemory::Transient);
+
+        for (size_t i = 0; i < count; ++i) {
+            batch.functions.push_back(reinterpret_cast<double (*)()>(
+                    session.jit.getFunctionAddress(batch.handle, anonymousExprName(i))));
+        }
+
+        session.exprsInLlvmContext += count;
+        if (session.exprsInLlvmContext >= kExprsPerLlvmContext)
+            recycleLlvmContext(session);
+        return batch;
+    }
+
+    // Evaluate the expressions of a batch, in parallel if the session has a thread pool
+    // and none of them may call an extern with side effects, and print the results in
+    // source order. This touches neither the JIT nor the IR,
+    // so it may run on another thread than the one compiling. With --profile the code
+    // updates the counters of session.profile meanwhile, which is why they are atomic.
+    void runExprBatch(Session& session, const ExprBatch& batch)
+    {
+        const size_t count = batch.functions.size();
+        std::vector<double> results(count);
+        const PhaseScope phase(Phase::Execute);
+        if (session.pool && !batch.sequential) {
+            session.pool->parallelFor(count, [&](size_t i) { results[i] = batch.functions[i](); });
+        } else {
+            for (size_t i = 0; i < count; ++i)
+                results[i] = batch.functions[i]();
+        }
+
+        std::lock_guard<std::mutex> lock(session.outMutex);
+        for (const double result : results)
+            session.out << "Evaluated to " << std::setprecision(17) << result << std::endl;
+    }
+
+    // Free the code of a batch which has been evaluated, and reoptimize the functions
+    // which have become hot.
+    void finishExprBatch(Session& session, const ExprBatch& batch)
+    {
+        session.jit.removeModule(batch.handle);
+
+        if (session.options.profile)
+            reoptimizeHotFunctions(session);
+    }
+
+    // Compile the pending top-level expressions, evaluate them and free their code.
+    void evaluatePendingExprs(Session& session)
+    {
+        const ExprBatch batch = compilePendingExprs(session);
+        if (batch.functions.empty())
+            return;
+        runExprBatch(session, batch);
+        finishExprBatch(session, batch);
+    }
+
+    // Compile the functions cloned by the specializer since the last call into
+    // a module of their own, which stays in the JIT like a definition.
+    // This must be done before compiling the code which calls them.
+    void compileSpecializations(Session& session)
+    {
+        if (!session.specializer)
+            return;
+        std::vector<std::unique_ptr<FunctionNode>> functions = session.specializer->takeNewFunctions();
+        if (functions.empty())
+            return;
+
+        // The current module may hold pending expressions, whose code is freed
+        // after they run; set it aside meanwhile.
+        Context& context = session.context;
+        auto pending = context.takeModule(new llvm::Module("my module", *session.llvmContext));
+        try {
+            for (const auto& function : functions) {
+                llvm::Function* func = function->Codegen(context);
+                if (session.options.emit == EmitMode::Trace) {
+                    session.emit << "Read specialized function: ";
+                    printFunction(session.emit, func);
+                } else if (session.options.emit == EmitMode::Ast) {
+                    session.emit << "(def ";
+                    printAst(session.emit, *function->prototype());
+                    session.emit << ' ';
+                    printAst(session.emit, *function->body());
+                    session.emit << ")\n";
+                }
+                session.instructionCount += countInstructions(func);
+            }
+        } catch (const CodegenError&) {
+            context.takeModule(pending.release());
+            throw;
+        }
+        auto module = context.takeModule(pending.release());
+        emitModule(session, *module);
+        std::vector<std::string> names;
+        for (const auto& function : functions)
+            names.push_back(function->prototype()->name());
+        session.jit.addDefinitions(std::move(module), names);
+
+        for (auto& function : functions) {
+            const std::string name = function->prototype()->name();
+            session.definitions[name] = std::move(function);
+        }
+    }
+
+    // Compile a definition. Definitions stay in the JIT for the rest of the session,
+    // and those whose callees are all linked are published for Jit::lookup().
+    // Pending expressions must have been compiled before, since they must not see it.
+    void compileDefinition(Session& session, std::unique_ptr<FunctionNode> node)
+    {
+        Context& context = session.context;
+        compileSpecializations(session);
+
+        llvm::Function* func = node->Codegen(context);
+        if (session.options.emit == EmitMode::Trace) {
+            session.emit << "Read function definition: ";
+            printFunction(session.emit, func);
+        } else if (session.options.emit == EmitMode::Ast) {
+            session.emit << "(def ";
+            printAst(session.emit, *node->prototype());
+            session.emit << ' ';
+            printAst(session.emit, *node->body());
+            session.emit << ")\n";
+        }
+        session.instructionCount += countInstructions(func);
+
+        auto module = context.takeModule(new llvm::Module("my module", *session.llvmContext));
+        emitModule(session, *module);
+        const std::string& name = node->prototype()->name();
+        session.jit.addDefinitions(std::move(module), {name});
+
+        session.reoptimized.erase(name);
+        session.definitions[name] = std::move(node);
+        session.linkable.clear();
+        session.pure.clear();
+    }
+
+    void compileExtern(Session& session, std::unique_ptr<PrototypeNode> node)
+    {
+        llvm::Function* func = node->Codegen(session.context);
+        session.context.declare(node->name(), node->argumentCount());
+        if (session.options.emit == EmitMode::Trace) {
+            session.emit << "Read extern: ";
+            printFunction(session.emit, func);
+        } else if (session.options.emit == EmitMode::Ast) {
+            session.emit << "(extern ";
+            printAst(session.emit, *node);
+            session.emit << ")\n";
+        }
+        session.externs.push_back(std::move(node));
+    }
+
+    // Generate the IR of a top-level expression named anonymousExprName(session.pendingExprs)
+    // into the current module and count it as pending.
+    void compileTopLevelExpr(Session& session, std::unique_ptr<FunctionNode> node)
+    {
+        compileSpecializations(session);
+        checkCallsLink(session, *node->body());
+        llvm::Function* func = node->Codegen(session.context);
+        if (session.options.emit == EmitMode::Trace) {
+            session.emit << "Read top-level expression: ";
+            printFunction(session.emit, func);
+        } else if (session.options.emit == EmitMode::Ast) {
+            printAst(session.emit, *node->body());
+            session.emit << '\n';
+        }
+        session.instructionCount += countInstructions(func);
+        ++session.pendingExprs;
+        if (session.pool && !isPure(session, *node->body()))
+            session.pendingForeignCalls = true;
+    }
+
+    bool parseOneAndPrint(Iter& it, Session& session)
     {
         if (dynamic_cast<EofToken*>(it->get())) {
+            evaluatePendingExprs(session);
             return true;
         }
 
         if (dynamic_cast<DefToken*>(it->get())) {
-            std::unique_ptr<FunctionNode> node = parseDefinition(it);
-            std::unique_ptr<llvm::Function> func(node->Codegen(context));
-            std::cerr << "Read function definition: ";
-            func->dump();
+            // expressions read before a (re)definition must not see it
+            evaluatePendingExprs(session);
+
+            std::unique_ptr<FunctionNode> node = parseDefinition(
+                    it, session.specializer.get(), session.exprTable.get(), session.diagnostics);
+            if (!node) {
+                skipToNextItem(it);
+                return false;
+            }
+            compileDefinition(session, std::move(node));
             return false;
         }
 
         if (dynamic_cast<ExternToken*>(it->get())) {
-            std::unique_ptr<PrototypeNode> node = parseExtern(it);
-            std::unique_ptr<llvm::Function> func(node->Codegen(context));
-            std::cerr << "Read extern: ";
-            func->dump();
+            std::unique_ptr<PrototypeNode> node = parseExtern(it, session.diagnostics);
+            if (!node) {
+                skipToNextItem(it);
+                return false;
+            }
+            compileExtern(session, std::move(node));
             return false;
         }
 
@@ -210,27 +982,404 @@ namespace {
             }
         }
 
-        std::unique_ptr<FunctionNode> node = parseTopLevelExpr(it);
-        std::unique_ptr<llvm::Function> func(node->Codegen(context));
-        std::cerr << "Read top-level expression: ";
-        func->dump();
+        std::unique_ptr<FunctionNode> node = parseTopLevelExpr(
+                it, anonymousExprName(session.pendingExprs), session.specializer.get(), session.exprTable.get(),
+                session.diagnostics);
+        if (!node) {
+            skipToNextItem(it);
+            return false;
+        }
+        compileTopLevelExpr(session, std::move(node));
+
+        // Expressions get modules of their own, whose IR is freed once compiled
+        // and whose machine code is freed once they have run. With a thread pool,
+        // consecutive expressions are batched so that they can run in parallel.
+        if (!session.pool || session.pendingExprs >= kMaxPendingExprs)
+            evaluatePendingExprs(session);
         return false;
     }
 
+
+    // Write what is left at the end of the input: the emitted module, the diagnostics and statistics.
+    void finishSession(Session& session)
+    {
+        const Options& options = session.options;
+        std::ostream& out = session.out;
+
+        if (session.emitted)
+            writeEmittedModule(session);
+        session.emit.flush();
+
+        session.diagnostics.print(out);
+
+        if (session.exprTable) {
+            out << "Hash-consing: " << session.exprTable->internedCount() << " expression nodes shared as "
+                << session.exprTable->size() << ", " << session.instructionCount << " instructions generated"
+                << std::endl;
+        }
+
+        if (options.jitStats) {
+            const JitMemory::Stats stats = session.jit.memoryStats();
+            out << "JIT memory: " << stats.reservedBytes << " bytes reserved, " << stats.usedBytes << " used, "
+                << stats.wastedBytes << " wasted; " << stats.mmapCalls << " mmap and " << stats.mprotectCalls
+                << " mprotect calls" << std::endl;
+        }
+
+        if (!options.profileOutput.empty()) {
+            std::ofstream file(options.profileOutput);
+            session.profile.dump(file);
+            if (!file)
+                out << "Failed to write the profile to " << options.profileOutput << std::endl;
+        }
+    }
+
+    // An item parsed by the parse stage of a pipeline. It is not rewritten by the
+    // specializer or hash-consed yet, since their state belongs to the compile stage.
+    struct ParsedItem {
+        // set for a definition
+        std::unique_ptr<FunctionNode> definition;
+        // set for an extern, and for a top-level expression, unnamed until compiled
+        std::unique_ptr<PrototypeNode> prototype;
+        // set for a top-level expression
+        std::shared_ptr<const ExprNode> body;
+        // number of errors in the diagnostics of the chunk up to and including this item
+        size_t errorsEnd;
+    };
+
+    // The tokens of the input up to and including a ';', and the items parsed from them.
+    // A chunk never splits an item, and the tokens skipped after an error never
+    // reach past its end, so chunks can be parsed independently.
+    struct Chunk {
+        Chunk(): tokens(), items(), diagnostics(new Diagnostics()), error(), last(false) {}
+
+        // ends with an EofToken, which is only the real end of the input in the last chunk
+        std::vector<std::unique_ptr<Token>> tokens;
+        std::vector<ParsedItem> items;
+        std::unique_ptr<Diagnostics> diagnostics;
+        // set if tokenization failed at the end of the chunk
+        std::unique_ptr<TokenizationError> error;
+        bool last;
+    };
+
+    // Maximum number of chunks or expression batches waiting between two stages.
+    const size_t kPipelineDepth = 64;
+
+    void lexStage(std::istream& input, const std::string& filename, SpscQueue<std::unique_ptr<Chunk>>& lexed)
+    {
+        Lexer lexer(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), filename);
+        std::unique_ptr<Chunk> chunk(new Chunk());
+        for (;;) {
+            try {
+                chunk->tokens.push_back(lexer.next());
+            } catch (const TokenizationError& e) {
+                chunk->error.reset(new TokenizationError(e));
+                chunk->tokens.emplace_back(new EofToken(e.position()));
+                chunk->last = true;
+                lexed.push(std::move(chunk));
+                return;
+            }
+
+            const Token* token = chunk->tokens.back().get();
+            if (dynamic_cast<const EofToken*>(token)) {
+                chunk->last = true;
+                lexed.push(std::move(chunk));
+                return;
+            }
+            const CharToken* t = dynamic_cast<const CharToken*>(token);
+            if (t && t->ch() == ';') {
+                chunk->tokens.emplace_back(new EofToken(t->position()));
+                lexed.push(std::move(chunk));
+                chunk.reset(new Chunk());
+            }
+        }
+    }
+
+    // Parse the items of a chunk the way parseOneAndPrint() does.
+    void parseChunk(Chunk& chunk)
+    {
+        const PhaseScope phase(Phase::Parse);
+        Diagnostics& diagnostics = *chunk.diagnostics;
+        Iter it = chunk.tokens.begin();
+        for (;;) {
+            if (dynamic_cast<EofToken*>(it->get()))
+                return;
+            if (const CharToken* t = dynamic_cast<CharToken*>(it->get())) {
+                if (t->ch() == ';') {
+                    ++it;
+                    continue;
+                }
+            }
+
+            ParsedItem item = ParsedItem();
+            bool parsed;
+            if (dynamic_cast<DefToken*>(it->get())) {
+                item.definition = parseDefinition(it, nullptr, nullptr, diagnostics);
+                parsed = item.definition != nullptr;
+            } else if (dynamic_cast<ExternToken*>(it->get())) {
+                item.prototype = parseExtern(it, diagnostics);
+                parsed = item.prototype != nullptr;
+            } else {
+                const Position& pos = (*it)->position();
+                item.body = parseExpr(it, diagnostics);
+                parsed = item.body != nullptr;
+                if (parsed)
+                    item.prototype.reset(new PrototypeNode(pos, "", std::vector<std::string>()));
+            }
+            if (!parsed)
+                skipToNextItem(it);
+            item.errorsEnd = diagnostics.size();
+            chunk.items.push_back(std::move(item));
+        }
+    }
+
+    void parseStage(SpscQueue<std::unique_ptr<Chunk>>& lexed, SpscQueue<std::unique_ptr<Chunk>>& parsed)
+    {
+        for (;;) {
+            std::unique_ptr<Chunk> chunk;
+            lexed.pop(&chunk);
+            parseChunk(*chunk);
+            const bool last = chunk->last;
+            parsed.push(std::move(chunk));
+            if (last)
+                return;
+        }
+    }
+
+    // Evaluate the batches compiled by the compile stage and hand them back to be freed.
+    // A batch without functions ends the stage and is handed back as well.
+    void executeStage(Session& session, SpscQueue<ExprBatch>& compiled, SpscQueue<ExprBatch>& finished)
+    {
+        for (;;) {
+            ExprBatch batch;
+            compiled.pop(&batch);
+            const bool end = batch.functions.empty();
+            if (!end)
+                runExprBatch(session, batch);
+            finished.push(std::move(batch));
+            if (end)
+                return;
+        }
+    }
+
+    // Free the batches which the execute stage has finished with. Returns true once
+    // the batch which ends the stage comes back.
+    bool retireExprBatches(Session& session, SpscQueue<ExprBatch>& finished)
+    {
+        ExprBatch batch;
+        while (finished.tryPop(&batch)) {
+            if (batch.functions.empty())
+                return true;
+            finishExprBatch(session, batch);
+        }
+        return false;
+    }
+
+    // Hand a batch to the execute stage. While the stage is busy, batches it has
+    // finished are freed, so that neither stage can wait for the other forever.
+    void sendExprBatch(Session& session, ExprBatch&& batch, SpscQueue<ExprBatch>& compiled,
+                       SpscQueue<ExprBatch>& finished)
+    {
+        Backoff backoff(compiled.doorbell());
+        while (!compiled.tryPush(std::move(batch))) {
+            retireExprBatches(session, finished);
+            backoff.wait();
+        }
+    }
+
+    void launchPendingExprs(Session& session, SpscQueue<ExprBatch>& compiled, SpscQueue<ExprBatch>& finished)
+    {
+        ExprBatch batch = compilePendingExprs(session);
+        if (!batch.functions.empty())
+            sendExprBatch(session, std::move(batch), compiled, finished);
+    }
+
+    // Rewrite a body parsed by the parse stage as parseDefinition() and parseTopLevelExpr() do.
+    // Returns null if neither specialization nor hash-consing is enabled.
+    std::shared_ptr<const ExprNode> rewriteBody(Session& session, const std::string& name, const ExprNode& body)
+    {
+        std::shared_ptr<const ExprNode> result;
+        if (session.specializer)
+            result = session.specializer->rewrite(name, body);
+        if (session.exprTable)
+            result = session.exprTable->intern(result ? *result : body);
+        return result;
+    }
+
+    void compileParsedItem(Session& session, ParsedItem& item, SpscQueue<ExprBatch>& compiled,
+                           SpscQueue<ExprBatch>& finished)
+    {
+        if (item.definition) {
+            // expressions read before a (re)definition must not see it
+            launchPendingExprs(session, compiled, finished);
+
+            std::unique_ptr<FunctionNode> node = std::move(item.definition);
+            if (auto body = rewriteBody(session, node->prototype()->name(), *node->body())) {
+                std::unique_ptr<PrototypeNode> proto(new PrototypeNode(*node->prototype()));
+                node.reset(new FunctionNode(std::move(proto), body));
+            }
+            compileDefinition(session, std::move(node));
+        } else if (item.body) {
+            const std::string name = anonymousExprName(session.pendingExprs);
+            std::shared_ptr<const ExprNode> body = rewriteBody(session, name, *item.body);
+            std::unique_ptr<PrototypeNode> proto(
+                    new PrototypeNode(item.prototype->position(), name, std::vector<std::string>()));
+            compileTopLevelExpr(session, std::unique_ptr<FunctionNode>(
+                    new FunctionNode(std::move(proto), body ? body : item.body)));
+            if (!session.pool || session.pendingExprs >= kMaxPendingExprs)
+                launchPendingExprs(session, compiled, finished);
+        } else if (item.prototype) {
+            compileExtern(session, std::move(item.prototype));
+        }
+    }
+
+    // Write the tokens of a chunk for --emit=trace or --emit=tokens. Tokens are
+    // traced chunk by chunk, before the items read from them.
+    void printChunkTokens(Session& session, const Chunk& chunk)
+    {
+        const bool trace = session.options.emit == EmitMode::Trace;
+        if (!trace && session.options.emit != EmitMode::Tokens)
+            return;
+
+        if (trace)
+            session.emit << "Tokens:";
+        const size_t count = chunk.tokens.size() - (chunk.last && !chunk.error ? 0 : 1);
+        for (size_t i = 0; i < count; ++i) {
+            session.emit << ' ';
+            chunk.tokens[i]->print(session.emit);
+        }
+        if (trace || chunk.last)
+            session.emit << '\n';
+    }
+
+    // Compile the items of the parsed chunks in order, sending top-level expressions
+    // to the execute stage, until the last chunk.
+    void compileStage(Session& session, SpscQueue<std::unique_ptr<Chunk>>& parsed, SpscQueue<ExprBatch>& compiled,
+                      SpscQueue<ExprBatch>& finished)
+    {
+        if (session.options.emit == EmitMode::Tokens)
+            session.emit << "Tokens:";
+
+        for (;;) {
+            // While waiting for input, evaluate what has been read so far.
+            std::unique_ptr<Chunk> chunk;
+            Backoff backoff(parsed.doorbell());
+            while (!parsed.tryPop(&chunk)) {
+                launchPendingExprs(session, compiled, finished);
+                retireExprBatches(session, finished);
+                backoff.wait();
+            }
+            printChunkTokens(session, *chunk);
+
+            const Diagnostics& errors = *chunk->diagnostics;
+            size_t reported = 0;
+            for (ParsedItem& item : chunk->items) {
+                for (; reported < item.errorsEnd; ++reported)
+                    session.diagnostics.report(errors.position(reported), std::string(errors.message(reported)));
+                try {
+                    compileParsedItem(session, item, compiled, finished);
+                } catch (const CodegenError& e) {
+                    // the rest of the chunk is skipped, as skipToNextItem() does
+                    session.diagnostics.report(e.position(), e.message());
+                    break;
+                }
+            }
+            if (chunk->error)
+                session.diagnostics.report(chunk->error->position(), chunk->error->message());
+            if (chunk->last)
+                break;
+        }
+
+        launchPendingExprs(session, compiled, finished);
+        sendExprBatch(session, ExprBatch(), compiled, finished);
+        Backoff backoff(finished.doorbell());
+        while (!retireExprBatches(session, finished))
+            backoff.wait();
+    }
+
 }   // namespace anonymous
 
 
 namespace kaleidoscope {
 
+    std::unique_ptr<ExprNode> parseExpr(Iter& it, Diagnostics& diagnostics)
+    {
+        std::unique_ptr<ExprNode> lhs = parsePrimary(it, diagnostics);
+        if (!lhs)
+            return nullptr;
+        return parseBinaryExprRhs(it, 0, std::move(lhs), diagnostics);
+    }
+
     std::unique_ptr<ExprNode> parseExpr(Iter& it)
     {
-        std::unique_ptr<ExprNode> lhs = parsePrimary(it);
-        return parseBinaryExprRhs(it, 0, std::move(lhs));
+        Diagnostics diagnostics;
+        std::unique_ptr<ExprNode> node = parseExpr(it, diagnostics);
+        if (!node)
+            throw ParseError(diagnostics.position(0), diagnostics.message(0));
+        return node;
+    }
+
+    bool parseItem(Iter& it, const std::string& name, Diagnostics& diagnostics, std::unique_ptr<Node>* item)
+    {
+        for (;;) {
+            const CharToken* t = dynamic_cast<CharToken*>(it->get());
+            if (!t || t->ch() != ';')
+                break;
+            ++it;
+        }
+
+        if (dynamic_cast<EofToken*>(it->get()))
+            return false;
+
+        if (dynamic_cast<DefToken*>(it->get())) {
+            *item = parseDefinition(it, nullptr, nullptr, diagnostics);
+        } else if (dynamic_cast<ExternToken*>(it->get())) {
+            *item = parseExtern(it, diagnostics);
+        } else {
+            *item = parseTopLevelExpr(it, name, nullptr, nullptr, diagnostics);
+        }
+
+        if (!*item)
+            skipToNextItem(it);
+        return true;
+    }
+
+    llvm::Value* ExprNode::CodegenBool(Context& context) const
+    {
+        return context.builder().CreateFCmpONE(
+                Codegen(context), llvm::ConstantFP::get(context.builder().getDoubleTy(), 0.0), "tobool");
+    }
+
+    llvm::Value* ExprNode::CodegenOnce(Context& context) const
+    {
+        // a shared boolean node remembers its i1
+        if (boolean_)
+            return context.builder().CreateUIToFP(CodegenBoolOnce(context), context.builder().getDoubleTy(),
+                                                  "booltmp");
+        if (!shared_)
+            return Codegen(context);
+
+        // Values generated inside the body of a reduction are forgotten when the
+        // loop ends (see ReductionExprNode), so a remembered value dominates every later use.
+        llvm::Value*& value = context.sharedValues()[this];
+        if (!value)
+            value = Codegen(context);
+        return value;
     }
 
-    llvm::Value* NumberExprNode::Codegen(Context&) const
+    llvm::Value* ExprNode::CodegenBoolOnce(Context& context) const
     {
-        return llvm::ConstantFP::get(llvm::getGlobalContext(), llvm::APFloat(value_));
+        if (!shared_)
+            return CodegenBool(context);
+
+        llvm::Value*& value = context.sharedValues()[this];
+        if (!value)
+            value = CodegenBool(context);
+        return value;
+    }
+
+    llvm::Value* NumberExprNode::Codegen(Context& context) const
+    {
+        return llvm::ConstantFP::get(context.llvmContext(), llvm::APFloat(value_));
     }
 
     llvm::Value* VariableExprNode::Codegen(Context& context) const
@@ -243,25 +1392,172 @@ namespace kaleidoscope {
 
     llvm::Value* BinaryExprNode::Codegen(Context& context) const
     {
-        llvm::Value* l = lhs_->Codegen(context);
-        llvm::Value* r = rhs_->Codegen(context);
+        llvm::IRBuilder<>& builder = context.builder();
+        if (boolean())
+            return builder.CreateUIToFP(CodegenBool(context), builder.getDoubleTy(), "booltmp");
+
+        // Boolean operands are kept as i1 where the result can be computed without
+        // converting them. Operands are generated left to right, as calls may have side effects.
+        const bool lhsBoolean = lhs_->boolean();
+        const bool rhsBoolean = rhs_->boolean();
+        if ((op_ == '+' || op_ == '-') && lhsBoolean && rhsBoolean) {
+            // exact, as the result is -1, 0, 1 or 2
+            llvm::Value* l = builder.CreateZExt(lhs_->CodegenBoolOnce(context), builder.getInt32Ty());
+            llvm::Value* r = builder.CreateZExt(rhs_->CodegenBoolOnce(context), builder.getInt32Ty());
+            llvm::Value* v = op_ == '+' ? builder.CreateAdd(l, r, "addtmp") : builder.CreateSub(l, r, "subtmp");
+            return builder.CreateSIToFP(v, builder.getDoubleTy(), "inttmp");
+        }
+        if (op_ == '*' && (lhsBoolean || rhsBoolean)) {
+            llvm::Value* b;
+            llvm::Value* x;
+            if (lhsBoolean) {
+                b = lhs_->CodegenBoolOnce(context);
+                x = rhs_->CodegenOnce(context);
+            } else {
+                x = lhs_->CodegenOnce(context);
+                b = rhs_->CodegenBoolOnce(context);
+            }
+            // 1 * x is x exactly. 0 * x is -0 for negative x and NaN for infinities and NaNs,
+            // so it is computed; under fast-math, it folds to 0.
+            llvm::Value* zero = builder.CreateFMul(llvm::ConstantFP::get(builder.getDoubleTy(), 0.0), x, "multmp");
+            return builder.CreateSelect(b, x, zero, "seltmp");
+        }
+
+        llvm::Value* l = lhs_->CodegenOnce(context);
+        llvm::Value* r = rhs_->CodegenOnce(context);
 
         switch (op_) {
-        case '+': return context.builder().CreateFAdd(l, r, "addtmp");
-        case '-': return context.builder().CreateFSub(l, r, "subtmp");
-        case '*': return context.builder().CreateFMul(l, r, "multmp");
-        case '<':
-            l = context.builder().CreateFCmpULT(l, r, "cmptmp");
-            return context.builder().CreateUIToFP(
-                    l, llvm::Type::getDoubleTy(llvm::getGlobalContext()), "booltmp");
+        case '+': return builder.CreateFAdd(l, r, "addtmp");
+        case '-': return builder.CreateFSub(l, r, "subtmp");
+        case '*': return builder.CreateFMul(l, r, "multmp");
         default:
             throw CodegenError(position(), "invalid binary operator");
         }
     }
 
+    llvm::Value* BinaryExprNode::CodegenBool(Context& context) const
+    {
+        llvm::IRBuilder<>& builder = context.builder();
+        if (op_ == '*') {
+            // both operands are boolean
+            llvm::Value* l = lhs_->CodegenBoolOnce(context);
+            llvm::Value* r = rhs_->CodegenBoolOnce(context);
+            return builder.CreateAnd(l, r, "andtmp");
+        }
+
+        llvm::Value* cmp;
+        if (lhs_->boolean() && rhs_->boolean()) {
+            // 0 and 1 are ordered, so the unordered comparison is the unsigned one
+            llvm::Value* l = lhs_->CodegenBoolOnce(context);
+            llvm::Value* r = rhs_->CodegenBoolOnce(context);
+            cmp = builder.CreateICmpULT(l, r, "cmptmp");
+        } else {
+            llvm::Value* l = lhs_->CodegenOnce(context);
+            llvm::Value* r = rhs_->CodegenOnce(context);
+            cmp = builder.CreateFCmpULT(l, r, "cmptmp");
+        }
+        if (Profile* profile = context.profile()) {
+            const std::string key = "compare " + position().toString();
+            profile->emitIncrement(builder, key + " total");
+            profile->emitIncrement(builder, key + " true", builder.CreateZExt(cmp, builder.getInt64Ty()));
+        }
+        return cmp;
+    }
+
+    llvm::Value* ReductionExprNode::Codegen(Context& context) const
+    {
+        llvm::IRBuilder<>& builder = context.builder();
+        llvm::Type* doubleType = builder.getDoubleTy();
+        llvm::Type* int64Type = builder.getInt64Ty();
+
+        llvm::Value* start = start_->CodegenOnce(context);
+        llvm::Value* end = end_->CodegenOnce(context);
+
+        // Count with an integer so that the loop vectorizer can compute the trip count.
+        // fptosi of NaN or of a value out of range is poison, so the loop runs only if
+        // the span is ordered and positive, and the span is clamped before converting.
+        llvm::Function* ceil = llvm::Intrinsic::getDeclaration(context.module(), llvm::Intrinsic::ceil, doubleType);
+        llvm::Value* span = builder.CreateCall(ceil, builder.CreateFSub(end, start, "reduce.span"));
+        llvm::Value* runs = builder.CreateFCmpOGT(span, llvm::ConstantFP::get(doubleType, 0.0), "reduce.runs");
+        llvm::Constant* maxSpan = llvm::ConstantFP::get(doubleType, 4611686018427387904.0);   // 2^62
+        span = builder.CreateSelect(builder.CreateFCmpOGT(span, maxSpan), maxSpan, span);
+        span = builder.CreateSelect(runs, span, llvm::ConstantFP::get(doubleType, 0.0), "reduce.clamped");
+        llvm::Value* tripCount = builder.CreateFPToSI(span, int64Type, "reduce.tripcount");
+
+        llvm::Constant* identity;
+        switch (kind_) {
+        case Sum:     identity = llvm::ConstantFP::get(doubleType, 0.0); break;
+        case Product: identity = llvm::ConstantFP::get(doubleType, 1.0); break;
+        case Min:     identity = llvm::ConstantFP::getInfinity(doubleType, false); break;
+        case Max:     identity = llvm::ConstantFP::getInfinity(doubleType, true); break;
+        default:
+            throw CodegenError(position(), "invalid reduction");
+        }
+
+        llvm::Function* f = builder.GetInsertBlock()->getParent();
+        llvm::BasicBlock* preheader = builder.GetInsertBlock();
+        llvm::BasicBlock* loop = llvm::BasicBlock::Create(context.llvmContext(), "reduce.loop", f);
+        llvm::BasicBlock* exit = llvm::BasicBlock::Create(context.llvmContext(), "reduce.exit", f);
+        builder.CreateCondBr(builder.CreateICmpSGT(tripCount, builder.getInt64(0)), loop, exit);
+
+        builder.SetInsertPoint(loop);
+        llvm::PHINode* counter = builder.CreatePHI(int64Type, 2, "reduce.i");
+        llvm::PHINode* accumulator = builder.CreatePHI(doubleType, 2, "reduce.acc");
+        counter->addIncoming(builder.getInt64(0), preheader);
+        accumulator->addIncoming(identity, preheader);
+        llvm::Value* index = builder.CreateFAdd(start, builder.CreateSIToFP(counter, doubleType), variable_);
+
+        // The index variable shadows a parameter of the same name, and values
+        // generated for shared nodes outside the loop may depend on that parameter.
+        auto& namedValues = context.namedValues();
+        const auto shadowed = namedValues.find(variable_);
+        llvm::Value* const outerValue = shadowed == namedValues.end() ? nullptr : shadowed->second;
+        std::map<const ExprNode*, llvm::Value*> outerSharedValues;
+        outerSharedValues.swap(context.sharedValues());
+        namedValues[variable_] = index;
+
+        llvm::Value* value = body_->CodegenOnce(context);
+
+        context.sharedValues().swap(outerSharedValues);
+        if (outerValue)
+            namedValues[variable_] = outerValue;
+        else
+            namedValues.erase(variable_);
+
+        llvm::Value* next = combine(context, accumulator, value);
+        llvm::Value* nextCounter = builder.CreateNSWAdd(counter, builder.getInt64(1), "reduce.next");
+        llvm::BasicBlock* latch = builder.GetInsertBlock();
+        counter->addIncoming(nextCounter, latch);
+        accumulator->addIncoming(next, latch);
+        builder.CreateCondBr(builder.CreateICmpSLT(nextCounter, tripCount), loop, exit);
+
+        builder.SetInsertPoint(exit);
+        llvm::PHINode* result = builder.CreatePHI(doubleType, 2, "reduce.result");
+        result->addIncoming(identity, preheader);
+        result->addIncoming(next, latch);
+        return result;
+    }
+
+    llvm::Value* ReductionExprNode::combine(Context& context, llvm::Value* accumulator, llvm::Value* value) const
+    {
+        llvm::IRBuilder<>& builder = context.builder();
+        switch (kind_) {
+        case Sum:
+            return builder.CreateFAdd(accumulator, value, "reduce.sum");
+        case Product:
+            return builder.CreateFMul(accumulator, value, "reduce.product");
+        case Min:
+            // compare-and-select is the form the vectorizer recognizes as a min/max reduction
+            return builder.CreateSelect(builder.CreateFCmpOLT(value, accumulator), value, accumulator, "reduce.min");
+        case Max:
+            return builder.CreateSelect(builder.CreateFCmpOGT(value, accumulator), value, accumulator, "reduce.max");
+        }
+        throw CodegenError(position(), "invalid reduction");
+    }
+
     llvm::Value* CallExprNode::Codegen(Context& context) const
     {
-        llvm::Function* calleeFunction = context.module()->getFunction(callee_);
+        llvm::Function* calleeFunction = context.getFunction(callee_);
         if (!calleeFunction)
             throw CodegenError(position(), "unknown function referenced");
 
@@ -270,17 +1566,31 @@ namespace kaleidoscope {
 
         std::vector<llvm::Value*> argValues;
         for (size_t i = 0, e = args_.size(); i != e; ++i) {
-            argValues.push_back(args_[i]->Codegen(context));
+            argValues.push_back(args_[i]->CodegenOnce(context));
         }
 
+        // Calls to math functions declared by `extern` become intrinsics,
+        // which LLVM can constant-fold, hoist and vectorize.
+        if (!context.isDefined(callee_) && calleeFunction->empty()) {
+            const llvm::Intrinsic::ID id = getMathIntrinsic(callee_, args_.size(), context.fpMode());
+            if (id != llvm::Intrinsic::not_intrinsic) {
+                llvm::Type* doubleType = llvm::Type::getDoubleTy(context.llvmContext());
+                calleeFunction = llvm::Intrinsic::getDeclaration(context.module(), id, doubleType);
+            }
+        }
+
+        if (Profile* profile = context.profile())
+            profile->emitIncrement(context.builder(), "call " + position().toString() + " " + callee_);
+
         return context.builder().CreateCall(calleeFunction, argValues, "calltmp");
     }
 
     llvm::Function* PrototypeNode::Codegen(Context& context) const {
+        const PhaseScope phase(Phase::Codegen);
         const std::vector<llvm::Type*> doubles(
-                args_.size(), llvm::Type::getDoubleTy(llvm::getGlobalContext()));
+                args_.size(), llvm::Type::getDoubleTy(context.llvmContext()));
         llvm::FunctionType* ft = llvm::FunctionType::get(
-                llvm::Type::getDoubleTy(llvm::getGlobalContext()), doubles, false);
+                llvm::Type::getDoubleTy(context.llvmContext()), doubles, false);
         llvm::Function* f = llvm::Function::Create(
                 ft, llvm::Function::ExternalLinkage, name_, context.module());
 
@@ -306,16 +1616,31 @@ namespace kaleidoscope {
     }
 
     llvm::Function* FunctionNode::Codegen(Context& context) const {
+        const PhaseScope phase(Phase::Codegen);
         context.namedValues().clear();
+        context.sharedValues().clear();
 
         llvm::Function* f = proto_->Codegen(context);
-        llvm::BasicBlock* block = llvm::BasicBlock::Create(llvm::getGlobalContext(), "entry", f);
+
+        // the loop vectorizer reads these to vectorize min/max reductions
+        if (context.fpMode() == FloatingPointMode::Fast) {
+            f->addFnAttr("unsafe-fp-math", "true");
+            f->addFnAttr("no-nans-fp-math", "true");
+        }
+
+        llvm::BasicBlock* block = llvm::BasicBlock::Create(context.llvmContext(), "entry", f);
         context.builder().SetInsertPoint(block);
 
+        if (Profile* profile = context.profile())
+            profile->emitIncrement(context.builder(), "entry " + proto_->name());
+
         try {
-            llvm::Value* ret = body_->Codegen(context);
+            llvm::Value* ret = body_->CodegenOnce(context);
             context.builder().CreateRet(ret);
             llvm::verifyFunction(*f);
+            // declared only now, so that a failed definition cannot be called later
+            context.declare(proto_->name(), proto_->argumentCount());
+            context.define(proto_->name());
         } catch (const CodegenError&) {
             f->eraseFromParent();
             throw;
@@ -324,27 +1649,44 @@ namespace kaleidoscope {
         return f;
     }
 
-    void parseAndPrint(Iter& it)
+    void parseAndPrint(Iter& it, const Options& options, llvm::LLVMContext& llvmContext,
+                       std::ostream& out, std::ostream& emit)
     {
-        llvm::LLVMContext& globalContext = llvm::getGlobalContext();
-        Context context(new llvm::Module("my module", globalContext), globalContext);
+        Session session(options, llvmContext, out, emit);
 
         for (;;) {
             try {
-                const bool finish = parseOneAndPrint(it, context);
+                const bool finish = parseOneAndPrint(it, session);
                 if (finish)
-                    return;
-            } catch (const BasicError& e) {
-                std::cerr << e.what() << std::endl;
-                // discard tokens until next ';'
-                for (;;) {
-                    const CharToken* t = dynamic_cast<CharToken*>(it->get());
-                    ++it;
-                    if (t && t->ch() == ';')
-                        break;
-                }
+                    break;
+            } catch (const CodegenError& e) {
+                session.diagnostics.report(e.position(), e.message());
+                skipToNextItem(it);
             }
         }
+        finishSession(session);
+    }
+
+    void parseAndPrintPipelined(std::istream& input, const std::string& filename, const Options& options,
+                                llvm::LLVMContext& llvmContext, std::ostream& out, std::ostream& emit)
+    {
+        Session session(options, llvmContext, out, emit);
+        // One doorbell for all the queues, since the compile stage waits on two at once.
+        Doorbell doorbell;
+        SpscQueue<std::unique_ptr<Chunk>> lexed(kPipelineDepth, &doorbell);
+        SpscQueue<std::unique_ptr<Chunk>> parsed(kPipelineDepth, &doorbell);
+        SpscQueue<ExprBatch> compiled(kPipelineDepth, &doorbell);
+        SpscQueue<ExprBatch> finished(kPipelineDepth, &doorbell);
+
+        std::thread lexer([&] { lexStage(input, filename, lexed); });
+        std::thread parser([&] { parseStage(lexed, parsed); });
+        std::thread executor([&] { executeStage(session, compiled, finished); });
+        compileStage(session, parsed, compiled, finished);
+        executor.join();
+        parser.join();
+        lexer.join();
+
+        finishSession(session);
     }
 
 }   // namespace kaleidoscope
@@ -1,16 +1,22 @@
 #pragma once
 
+#include <istream>
+#include <iterator>
 #include <memory>
+#include <ostream>
 #include <vector>
 
 #include <llvm/IR/Verifier.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
 #include "context.hpp"
+#include "diagnostics.hpp"
 #include "error.hpp"
+#include "options.hpp"
 #include "position.hpp"
 #include "token.hpp"
 
@@ -35,9 +41,43 @@ namespace kaleidoscope {
 
     class ExprNode: public Node {
     public:
-        explicit ExprNode(const Position& position): Node(position) {}
+        // `boolean` is true if the value is always 0 or 1 (see boolean()).
+        explicit ExprNode(const Position& position, bool boolean = false):
+            Node(position), shared_(false), boolean_(boolean) {}
 
         virtual llvm::Value* Codegen(Context& context) const = 0;
+
+        // Generate the value of a boolean node as an i1.
+        // The default compares the result of Codegen with 0.
+        virtual llvm::Value* CodegenBool(Context& context) const;
+
+        // Like Codegen, but if this node is shared by several parents (see ExprTable),
+        // the value generated for it earlier in the same function is reused.
+        llvm::Value* CodegenOnce(Context& context) const;
+
+        // Like CodegenBool, reusing the value of a shared node as CodegenOnce does.
+        llvm::Value* CodegenBoolOnce(Context& context) const;
+
+        bool shared() const noexcept {
+            return shared_;
+        }
+
+        void markShared() noexcept {
+            shared_ = true;
+        }
+
+        // Every value is a double, but the value of a boolean node is always 0 or 1.
+        // It is inferred bottom-up as nodes are built: comparisons are boolean, and so are
+        // products of boolean operands. Boolean values are generated as i1 and
+        // converted to double only where a double is needed, such as arguments,
+        // return values and operations with other doubles.
+        bool boolean() const noexcept {
+            return boolean_;
+        }
+
+    private:
+        bool shared_;
+        bool boolean_;
     };
 
 
@@ -79,7 +119,13 @@ namespace kaleidoscope {
                        Operator op,
                        std::unique_ptr<ExprNode>&& lhs,
                        std::unique_ptr<ExprNode>&& rhs):
-            ExprNode(position), op_(op), lhs_(std::move(lhs)), rhs_(std::move(rhs)) {}
+            ExprNode(position, isBoolean(op, *lhs, *rhs)), op_(op), lhs_(std::move(lhs)), rhs_(std::move(rhs)) {}
+
+        BinaryExprNode(const Position& position,
+                       Operator op,
+                       const std::shared_ptr<const ExprNode>& lhs,
+                       const std::shared_ptr<const ExprNode>& rhs):
+            ExprNode(position, isBoolean(op, *lhs, *rhs)), op_(op), lhs_(lhs), rhs_(rhs) {}
 
         Operator op() const noexcept {
             return op_;
@@ -94,11 +140,16 @@ namespace kaleidoscope {
         }
 
         virtual llvm::Value* Codegen(Context& Context) const;
+        virtual llvm::Value* CodegenBool(Context& Context) const;
 
     private:
+        static bool isBoolean(Operator op, const ExprNode& lhs, const ExprNode& rhs) noexcept {
+            return op == '<' || (op == '*' && lhs.boolean() && rhs.boolean());
+        }
+
         Operator op_;
-        std::unique_ptr<ExprNode> lhs_;
-        std::unique_ptr<ExprNode> rhs_;
+        std::shared_ptr<const ExprNode> lhs_;
+        std::shared_ptr<const ExprNode> rhs_;
     };
 
 
@@ -107,6 +158,12 @@ namespace kaleidoscope {
         CallExprNode(const Position& position,
                      const std::string& callee,
                      std::vector<std::unique_ptr<ExprNode>>&& args):
+            ExprNode(position), callee_(callee), args_(std::make_move_iterator(args.begin()),
+                                                       std::make_move_iterator(args.end())) {}
+
+        CallExprNode(const Position& position,
+                     const std::string& callee,
+                     std::vector<std::shared_ptr<const ExprNode>>&& args):
             ExprNode(position), callee_(callee), args_(std::move(args)) {}
 
         const std::string& callee() const noexcept {
@@ -125,7 +182,57 @@ namespace kaleidoscope {
 
     private:
         std::string callee_;
-        std::vector<std::unique_ptr<ExprNode>> args_;
+        std::vector<std::shared_ptr<const ExprNode>> args_;
+    };
+
+
+    // A reduction over an index range, written as
+    //   sum(i = start, end, body)
+    // (or product, min, max). `body` is evaluated with `i` bound to
+    // start, start + 1, ... while it is less than `end`, and the results are
+    // combined. An empty range yields the identity of the operation.
+    class ReductionExprNode: public ExprNode {
+    public:
+        enum Kind { Sum, Product, Min, Max };
+
+        ReductionExprNode(const Position& position,
+                          Kind kind,
+                          const std::string& variable,
+                          const std::shared_ptr<const ExprNode>& start,
+                          const std::shared_ptr<const ExprNode>& end,
+                          const std::shared_ptr<const ExprNode>& body):
+            ExprNode(position), kind_(kind), variable_(variable), start_(start), end_(end), body_(body) {}
+
+        Kind kind() const noexcept {
+            return kind_;
+        }
+
+        const std::string& variable() const noexcept {
+            return variable_;
+        }
+
+        const ExprNode* start() const noexcept {
+            return start_.get();
+        }
+
+        const ExprNode* end() const noexcept {
+            return end_.get();
+        }
+
+        const ExprNode* body() const noexcept {
+            return body_.get();
+        }
+
+        virtual llvm::Value* Codegen(Context& Context) const;
+
+    private:
+        llvm::Value* combine(Context& context, llvm::Value* accumulator, llvm::Value* value) const;
+
+        Kind kind_;
+        std::string variable_;
+        std::shared_ptr<const ExprNode> start_;
+        std::shared_ptr<const ExprNode> end_;
+        std::shared_ptr<const ExprNode> body_;
     };
 
 
@@ -159,7 +266,7 @@ namespace kaleidoscope {
     class FunctionNode: public Node {
     public:
         FunctionNode(std::unique_ptr<PrototypeNode> proto,
-                     std::unique_ptr<ExprNode> body):
+                     std::shared_ptr<const ExprNode> body):
             Node(proto->position()), proto_(std::move(proto)), body_(std::move(body)) {}
 
         const PrototypeNode* prototype() const noexcept {
@@ -174,7 +281,7 @@ namespace kaleidoscope {
 
     private:
         std::unique_ptr<PrototypeNode> proto_;
-        std::unique_ptr<ExprNode> body_;
+        std::shared_ptr<const ExprNode> body_;
     };
 
 
@@ -194,9 +301,35 @@ namespace kaleidoscope {
 
     // Parse a sequence of tokens and returns the root of an abstract syntax tree.
     // This function destructively modifies `it` to point the head of unparsed tokens.
-    // If some error occurrs, this function throws ParseError.
+    // If some error occurrs, this function reports it to `diagnostics` and returns nullptr.
+    std::unique_ptr<ExprNode> parseExpr(std::vector<std::unique_ptr<Token>>::iterator& it,
+                                        Diagnostics& diagnostics);
+
+    // Same as above, but throws ParseError if some error occurrs.
     std::unique_ptr<ExprNode> parseExpr(std::vector<std::unique_ptr<Token>>::iterator& it);
 
-    void parseAndPrint(std::vector<std::unique_ptr<Token>>::iterator& it);
+    // Parse the next top-level item: a definition, an extern or a top-level expression,
+    // which is wrapped in a function named `name`. Semicolons before it are skipped.
+    // Returns false if there are no more items. On an error, the error is reported to
+    // `diagnostics`, `*item` is set to nullptr and `it` is moved to the next item.
+    bool parseItem(std::vector<std::unique_ptr<Token>>::iterator& it, const std::string& name,
+                   Diagnostics& diagnostics, std::unique_ptr<Node>* item);
+
+    // Parse and compile every item in the token sequence.
+    // Top-level expressions are compiled and evaluated as soon as they are read.
+    // Their results and the diagnostics are printed to `out`; what options.emit
+    // selects is written to `emit`, which may be the same stream.
+    // IR is created in `llvmContext`, which must not be used by other threads meanwhile;
+    // long sessions move on to LLVMContexts of their own to free the constants of old code.
+    void parseAndPrint(std::vector<std::unique_ptr<Token>>::iterator& it, const Options& options,
+                       llvm::LLVMContext& llvmContext, std::ostream& out, std::ostream& emit);
+
+    // Same as parseAndPrint(), but reads the input from `input` and runs lexing, parsing,
+    // compilation and evaluation as stages on threads of their own, connected by bounded queues.
+    // Each top-level expression is evaluated as soon as it has been compiled, while the
+    // rest of the input is still being read. `filename` is used for Position as in tokenize().
+    // With --emit=trace, the tokens are traced chunk by chunk rather than all at first.
+    void parseAndPrintPipelined(std::istream& input, const std::string& filename, const Options& options,
+                                llvm::LLVMContext& llvmContext, std::ostream& out, std::ostream& emit);
 
 }   // namespace kaleidoscope
@@ -1,36 +1,133 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 
+#include "options.hpp"
 #include "position.hpp"
+#include "profile.hpp"
 
 namespace kaleidoscope {
+    class ExprNode;
+
     class Context {
     public:
-        Context(llvm::Module* module, llvm::LLVMContext& llvmContext):
-            module_(module), builder_(llvmContext) {}
+        // If `profile` is not null, generated code is instrumented to update its counters.
+        Context(llvm::Module* module, llvm::LLVMContext& llvmContext,
+                FloatingPointMode fpMode = FloatingPointMode::Strict, Profile* profile = nullptr):
+            module_(module), builder_(createBuilder(llvmContext, fpMode)), fpMode_(fpMode), profile_(profile) {}
 
         llvm::Module* module() {
-            return module_;
+            return module_.get();
+        }
+
+        // Replace the module under construction with `module` and return the old one.
+        std::unique_ptr<llvm::Module> takeModule(llvm::Module* module) {
+            std::unique_ptr<llvm::Module> old(std::move(module_));
+            module_.reset(module);
+            return old;
+        }
+
+        // Replace the module under construction with `module`, which may belong to
+        // another LLVMContext, and create IR in its context from now on.
+        // The old module is deleted; no IR of the old context may be used afterwards.
+        void resetModule(llvm::Module* module) {
+            namedValues_.clear();
+            sharedValues_.clear();
+            builder_.reset(createBuilder(module->getContext(), fpMode_));
+            module_.reset(module);
+        }
+
+        llvm::LLVMContext& llvmContext() {
+            return builder_->getContext();
         }
 
         llvm::IRBuilder<>& builder() {
-            return builder_;
+            return *builder_;
+        }
+
+        FloatingPointMode fpMode() const noexcept {
+            return fpMode_;
+        }
+
+        Profile* profile() noexcept {
+            return profile_;
         }
 
         std::map<std::string, llvm::Value*>& namedValues() {
             return namedValues_;
         }
 
+        // Values already generated for shared nodes in the current function.
+        std::map<const ExprNode*, llvm::Value*>& sharedValues() {
+            return sharedValues_;
+        }
+
+        // Remember that a function `name` taking `argCount` doubles exists,
+        // so that modules created later can refer to it.
+        void declare(const std::string& name, size_t argCount) {
+            declarations_[name] = argCount;
+        }
+
+        bool isDeclared(const std::string& name) const {
+            return declarations_.count(name) != 0;
+        }
+
+        // Remember that the function `name` has a body written in Kaleidoscope,
+        // as opposed to one only declared by `extern`.
+        void define(const std::string& name) {
+            definitions_.insert(name);
+        }
+
+        bool isDefined(const std::string& name) const {
+            return definitions_.count(name) != 0;
+        }
+
+        // Look up a function by name. If it lives in a module which has already been
+        // taken, a declaration of it is added to the current module.
+        // Returns nullptr if no such function has been declared.
+        llvm::Function* getFunction(const std::string& name) {
+            if (llvm::Function* f = module_->getFunction(name))
+                return f;
+
+            const auto it = declarations_.find(name);
+            if (it == declarations_.end())
+                return nullptr;
+
+            llvm::Type* doubleType = llvm::Type::getDoubleTy(module_->getContext());
+            const std::vector<llvm::Type*> doubles(it->second, doubleType);
+            llvm::FunctionType* ft = llvm::FunctionType::get(doubleType, doubles, false);
+            return llvm::Function::Create(ft, llvm::Function::ExternalLinkage, name, module_.get());
+        }
+
     private:
-        llvm::Module* module_;
-        llvm::IRBuilder<> builder_;
+        static llvm::IRBuilder<>* createBuilder(llvm::LLVMContext& llvmContext, FloatingPointMode fpMode) {
+            auto builder = new llvm::IRBuilder<>(llvmContext);
+            // Contraction into FMA is decided by the code generator (see Jit),
+            // so only the fast mode needs flags on each instruction.
+            if (fpMode == FloatingPointMode::Fast) {
+                llvm::FastMathFlags flags;
+                flags.setUnsafeAlgebra();
+                builder->SetFastMathFlags(flags);
+            }
+            return builder;
+        }
+
+        std::unique_ptr<llvm::Module> module_;
+        std::unique_ptr<llvm::IRBuilder<>> builder_;
+        FloatingPointMode fpMode_;
+        Profile* profile_;
         std::map<std::string, llvm::Value*> namedValues_;
+        std::map<const ExprNode*, llvm::Value*> sharedValues_;
+        std::map<std::string, size_t> declarations_;
+        std::set<std::string> definitions_;
     };
 };
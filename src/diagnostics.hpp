@@ -0,0 +1,76 @@
+#pragma once
+
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "position.hpp"
+
+namespace kaleidoscope {
+
+    // A buffer of error messages.
+    //
+    // Reporting an error only records its position and a pointer to its message;
+    // nothing is formatted until print() is called, so error-heavy inputs
+    // do not pay for string building.
+    class Diagnostics {
+    public:
+        Diagnostics(): entries_(), ownedMessages_() {}
+
+        Diagnostics(const Diagnostics&) = delete;
+        Diagnostics& operator=(const Diagnostics&) = delete;
+
+        // Record an error. `message` must outlive this object, e.g. a string literal.
+        void report(const Position& position, const char* message) {
+            entries_.push_back(Entry { position, message });
+        }
+
+        // Record an error with a message built at run time.
+        void report(const Position& position, const std::string& message) {
+            ownedMessages_.push_back(message);
+            report(position, ownedMessages_.back().c_str());
+        }
+
+        size_t size() const noexcept {
+            return entries_.size();
+        }
+
+        bool empty() const noexcept {
+            return entries_.empty();
+        }
+
+        const Position& position(size_t i) const {
+            return entries_[i].position;
+        }
+
+        const char* message(size_t i) const {
+            return entries_[i].message;
+        }
+
+        // Write each error as "<name>:<line>:<column>: <message>" in the order reported.
+        void print(std::ostream& out) const {
+            for (const auto& entry : entries_) {
+                const Position& p = entry.position;
+                out << p.name() << ':' << p.line() << ':' << p.column() << ": " << entry.message << '\n';
+            }
+        }
+
+        void clear() {
+            entries_.clear();
+            ownedMessages_.clear();
+        }
+
+    private:
+        struct Entry {
+            Position position;
+            const char* message;
+        };
+
+        std::vector<Entry> entries_;
+
+        // std::deque never moves its elements, so pointers to them stay valid
+        std::deque<std::string> ownedMessages_;
+    };
+
+}   // namespace kaleidoscope
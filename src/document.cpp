@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+
+#include "document.hpp"
+
+namespace {
+
+    using namespace kaleidoscope;
+
+    // length of the longest keyword which starts a chunk, "extern"
+    const size_t kMaxKeywordLength = 6;
+
+    bool isIdentifierChar(char ch)
+    {
+        return std::isalpha(static_cast<unsigned char>(ch)) || ch == '_';
+    }
+
+    // Returns true if "def" or "extern" starts at text[i] as a word of its own.
+    bool startsKeyword(const std::string& text, size_t i)
+    {
+        if (i > 0 && isIdentifierChar(text[i - 1]))
+            return false;
+        for (const char* keyword : { "def", "extern" }) {
+            const size_t n = std::strlen(keyword);
+            if (text.compare(i, n, keyword) == 0 && (i + n == text.size() || !isIdentifierChar(text[i + n])))
+                return true;
+        }
+        return false;
+    }
+
+    // Scan `text` from `begin`, where a chunk starts, and append the starts of the
+    // following chunks to `starts`. Scanning stops at the first start for which
+    // `stopAt` returns true, which is returned, or at the end of the text.
+    size_t scanChunkStarts(const std::string& text, size_t begin, const std::function<bool(size_t)>& stopAt,
+                           std::vector<size_t>* starts)
+    {
+        bool afterSemicolon = false;
+        size_t i = begin;
+        while (i < text.size()) {
+            const char ch = text[i];
+            if (i != begin && ((afterSemicolon && !std::isspace(static_cast<unsigned char>(ch))) ||
+                               startsKeyword(text, i))) {
+                if (stopAt(i))
+                    return i;
+                starts->push_back(i);
+                afterSemicolon = false;
+            }
+
+            if (ch == '#') {
+                // a comment; its end is handled as whitespace
+                i = std::min(text.find('\n', i), text.size());
+                continue;
+            }
+            if (ch == ';')
+                afterSemicolon = true;
+            ++i;
+        }
+        return text.size();
+    }
+
+    bool sameToken(const Token& a, const Token& b)
+    {
+        if (typeid(a) != typeid(b))
+            return false;
+        if (auto t = dynamic_cast<const IdentifierToken*>(&a))
+            return t->name() == static_cast<const IdentifierToken&>(b).name();
+        if (auto t = dynamic_cast<const NumberToken*>(&a))
+            return t->number() == static_cast<const NumberToken&>(b).number();
+        if (auto t = dynamic_cast<const CharToken*>(&a))
+            return t->ch() == static_cast<const CharToken&>(b).ch();
+        return true;
+    }
+
+    // Returns the name of the function an item defines, or nullptr if it is not a definition.
+    // Top-level expressions are parsed as functions with an empty name.
+    const std::string* definitionName(const Node* node)
+    {
+        auto function = dynamic_cast<const FunctionNode*>(node);
+        if (!function || function->prototype()->name().empty())
+            return nullptr;
+        return &function->prototype()->name();
+    }
+
+}   // anonymous namespace
+
+
+namespace kaleidoscope {
+
+    Document::Document(const std::string& filename, const std::string& text):
+        filename_(filename), text_(text), chunks_()
+    {
+        edit(0, 0, "");
+    }
+
+    Document::Changes Document::edit(size_t offset, size_t length, const std::string& replacement)
+    {
+        offset = std::min(offset, text_.size());
+        length = std::min(length, text_.size() - offset);
+        const size_t oldEnd = offset + length;
+        const size_t newEnd = offset + replacement.size();
+        const size_t removedLines = std::count(text_.begin() + offset, text_.begin() + oldEnd, '\n');
+        const size_t insertedLines = std::count(replacement.begin(), replacement.end(), '\n');
+        text_.replace(offset, length, replacement);
+
+        // The chunk holding the character before the edit is the first one affected.
+        // Its start stays a start unless the edit is close enough to change the keyword
+        // there, in which case scanning begins one chunk earlier. Chunks starting at or
+        // after the old end of the edit are kept if a chunk still starts there, and so
+        // are all those after them.
+        size_t first = 0;
+        while (first + 1 < chunks_.size() && chunks_[first + 1].start < offset)
+            ++first;
+        while (first > 0 && offset <= chunks_[first].start + kMaxKeywordLength)
+            --first;
+        size_t firstKept = first + (chunks_.empty() ? 0 : 1);
+        while (firstKept < chunks_.size() && chunks_[firstKept].start < oldEnd)
+            ++firstKept;
+
+        const size_t begin = chunks_.empty() ? 0 : chunks_[first].start;
+        size_t resync = chunks_.size();
+        size_t candidate = firstKept;
+        auto stopAt = [&](size_t i) {
+            if (i < newEnd)
+                return false;
+            // starts are found in increasing order, so candidates are never revisited
+            for (; candidate < chunks_.size(); ++candidate) {
+                const size_t start = chunks_[candidate].start - length + replacement.size();
+                if (start > i)
+                    return false;
+                if (start == i) {
+                    resync = candidate;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        std::vector<size_t> starts;
+        size_t end = begin;
+        if (begin < text_.size()) {
+            starts.push_back(begin);
+            end = scanChunkStarts(text_, begin, stopAt, &starts);
+        }
+
+        // build the new chunks, counting lines from the start of the first one
+        size_t line = chunks_.empty() ? 1 : chunks_[first].line;
+        size_t column = chunks_.empty() ? 1 : chunks_[first].column;
+        size_t position = begin;
+        std::vector<Chunk> chunks;
+        for (size_t k = 0; k < starts.size(); ++k) {
+            for (; position < starts[k]; ++position) {
+                if (text_[position] == '\n') {
+                    ++line;
+                    column = 1;
+                } else {
+                    ++column;
+                }
+            }
+            chunks.push_back(makeChunk(starts[k], k + 1 < starts.size() ? starts[k + 1] : end, line, column));
+        }
+
+        // compare the definitions before and after
+        Changes changes = Changes();
+        std::map<std::string, std::pair<const Chunk*, const Item*>> oldDefinitions;
+        for (size_t j = first; j < resync; ++j) {
+            for (const Item& item : chunks_[j].items) {
+                if (const std::string* name = definitionName(item.node.get()))
+                    oldDefinitions.emplace(*name, std::make_pair(&chunks_[j], &item));
+            }
+        }
+        std::set<std::string> seen;
+        for (size_t k = 0; k < chunks.size(); ++k) {
+            const Chunk& chunk = chunks[k];
+            changes.relexedBytes += (k + 1 < chunks.size() ? chunks[k + 1].start : end) - chunk.start;
+            changes.reparsedItems += chunk.items.size();
+            for (const Item& item : chunk.items) {
+                const std::string* name = definitionName(item.node.get());
+                if (!name)
+                    continue;
+                seen.insert(*name);
+                const auto old = oldDefinitions.find(*name);
+                const bool same = old != oldDefinitions.end() &&
+                    old->second.second->lastToken - old->second.second->firstToken ==
+                        item.lastToken - item.firstToken &&
+                    std::equal(chunk.tokens.begin() + item.firstToken, chunk.tokens.begin() + item.lastToken,
+                               old->second.first->tokens.begin() + old->second.second->firstToken,
+                               [](const std::unique_ptr<Token>& a, const std::unique_ptr<Token>& b) {
+                                   return sameToken(*a, *b);
+                               });
+                if (!same)
+                    changes.changedDefinitions.push_back(*name);
+            }
+        }
+        for (const auto& old : oldDefinitions) {
+            if (!seen.count(old.first))
+                changes.removedDefinitions.push_back(old.first);
+        }
+
+        // Shift the chunks after the edit. Only those starting on the line where
+        // the edit ends can have moved to another column.
+        const size_t lineEnd = text_.find('\n', newEnd);
+        for (size_t j = resync; j < chunks_.size(); ++j) {
+            Chunk& chunk = chunks_[j];
+            chunk.start = chunk.start - length + replacement.size();
+            chunk.line = chunk.line - removedLines + insertedLines;
+            if (chunk.start <= lineEnd) {
+                const size_t newline = chunk.start == 0 ? std::string::npos : text_.rfind('\n', chunk.start - 1);
+                chunk.column = newline == std::string::npos ? chunk.start + 1 : chunk.start - newline;
+            }
+        }
+
+        chunks_.erase(chunks_.begin() + first, chunks_.begin() + resync);
+        chunks_.insert(chunks_.begin() + first,
+                       std::make_move_iterator(chunks.begin()), std::make_move_iterator(chunks.end()));
+        return changes;
+    }
+
+    std::vector<const Node*> Document::items() const
+    {
+        std::vector<const Node*> items;
+        for (const Chunk& chunk : chunks_) {
+            for (const Item& item : chunk.items)
+                items.push_back(item.node.get());
+        }
+        return items;
+    }
+
+    Position Document::absolutePosition(size_t index, const Position& position) const
+    {
+        for (const Chunk& chunk : chunks_) {
+            if (index < chunk.items.size())
+                return absolutePosition(chunk, position);
+            index -= chunk.items.size();
+        }
+        throw std::out_of_range("Document::absolutePosition: no such item");
+    }
+
+    std::unique_ptr<Diagnostics> Document::diagnostics() const
+    {
+        std::unique_ptr<Diagnostics> diagnostics(new Diagnostics());
+        for (const Chunk& chunk : chunks_) {
+            for (size_t i = 0; i < chunk.diagnostics->size(); ++i) {
+                diagnostics->report(absolutePosition(chunk, chunk.diagnostics->position(i)),
+                                    std::string(chunk.diagnostics->message(i)));
+            }
+        }
+        return diagnostics;
+    }
+
+    Position Document::absolutePosition(const Chunk& chunk, const Position& position) const
+    {
+        const size_t line = chunk.line + position.line() - 1;
+        const size_t column = position.line() == 1 ? chunk.column + position.column() - 1 : position.column();
+        return Position(filename_, line, column);
+    }
+
+    Document::Chunk Document::makeChunk(size_t start, size_t end, size_t line, size_t column) const
+    {
+        Chunk chunk { start, line, column, {}, {}, std::unique_ptr<Diagnostics>(new Diagnostics()) };
+
+        try {
+            std::istringstream stream(text_.substr(start, end - start));
+            chunk.tokens = tokenize(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(),
+                                    filename_);
+        } catch (const TokenizationError& e) {
+            chunk.diagnostics->report(e.position(), e.message());
+            return chunk;
+        }
+
+        auto it = chunk.tokens.begin();
+        for (;;) {
+            Item item { nullptr, static_cast<size_t>(it - chunk.tokens.begin()), 0 };
+            if (!parseItem(it, "", *chunk.diagnostics, &item.node))
+                break;
+            item.lastToken = it - chunk.tokens.begin();
+            chunk.items.push_back(std::move(item));
+        }
+        return chunk;
+    }
+
+}   // namespace kaleidoscope
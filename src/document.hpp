@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "diagnostics.hpp"
+#include "token.hpp"
+
+namespace kaleidoscope {
+
+    // A source file being edited, kept lexed and parsed.
+    //
+    // The text is split into chunks, each starting at "def", "extern" or the first
+    // character after a ';'. Every chunk has its own tokens, items and diagnostics,
+    // so an edit only re-lexes and re-parses the chunks it touches. Positions in
+    // the tokens and nodes of a chunk count from the start of the chunk, so that
+    // edits above it do not invalidate them; diagnostics() and absolutePosition()
+    // translate them.
+    class Document {
+    public:
+        // What an edit changed.
+        struct Changes {
+            // names of the definitions added or whose tokens changed
+            std::vector<std::string> changedDefinitions;
+
+            // names of the definitions no longer defined where they used to be
+            std::vector<std::string> removedDefinitions;
+
+            // number of characters lexed again
+            size_t relexedBytes;
+
+            // number of items parsed again
+            size_t reparsedItems;
+        };
+
+        Document(const std::string& filename, const std::string& text);
+
+        Document(const Document&) = delete;
+        Document& operator=(const Document&) = delete;
+
+        const std::string& text() const noexcept {
+            return text_;
+        }
+
+        // Replace `length` characters at `offset` with `replacement`.
+        Changes edit(size_t offset, size_t length, const std::string& replacement);
+
+        // Returns every item in source order. Nodes of items with errors are null.
+        std::vector<const Node*> items() const;
+
+        // Translate `position`, taken from the nodes of items()[index], to one counted
+        // from the start of the text. `index` must be less than the number of items.
+        Position absolutePosition(size_t index, const Position& position) const;
+
+        // Returns the errors of the whole text with positions counted from its start.
+        std::unique_ptr<Diagnostics> diagnostics() const;
+
+    private:
+        struct Item {
+            // the definition, extern or expression; null if it has an error
+            std::unique_ptr<Node> node;
+
+            // tokens of the item in its chunk
+            size_t firstToken;
+            size_t lastToken;
+        };
+
+        struct Chunk {
+            size_t start;
+            size_t line;
+            size_t column;
+            std::vector<std::unique_ptr<Token>> tokens;
+            std::vector<Item> items;
+            std::unique_ptr<Diagnostics> diagnostics;
+        };
+
+        Chunk makeChunk(size_t start, size_t end, size_t line, size_t column) const;
+        Position absolutePosition(const Chunk& chunk, const Position& position) const;
+
+        std::string filename_;
+        std::string text_;
+        std::vector<Chunk> chunks_;
+    };
+
+}   // namespace kaleidoscope
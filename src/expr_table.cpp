@@ -0,0 +1,84 @@
+#include <cstring>
+
+#include "expr_table.hpp"
+
+namespace kaleidoscope {
+
+    template <class Map, class Key, class Make>
+    std::shared_ptr<const ExprNode> ExprTable::lookup(Map& map, const Key& key, Make make)
+    {
+        auto it = map.find(key);
+        if (it != map.end()) {
+            it->second->markShared();
+            return it->second;
+        }
+        std::shared_ptr<ExprNode> node(make());
+        map.emplace(key, node);
+        ++createdCount_;
+        return node;
+    }
+
+    std::shared_ptr<const ExprNode> ExprTable::intern(const ExprNode& body)
+    {
+        numbers_.clear();
+        variables_.clear();
+        binaries_.clear();
+        calls_.clear();
+        reductions_.clear();
+        return internNode(body);
+    }
+
+    std::shared_ptr<const ExprNode> ExprTable::internNode(const ExprNode& node)
+    {
+        ++internedCount_;
+
+        if (auto n = dynamic_cast<const NumberExprNode*>(&node)) {
+            // compare bit patterns so that 0.0 and -0.0 stay distinct
+            const double value = n->value();
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return lookup(numbers_, bits, [&] {
+                return new NumberExprNode(n->position(), value);
+            });
+        }
+
+        if (auto n = dynamic_cast<const VariableExprNode*>(&node)) {
+            return lookup(variables_, n->name(), [&] {
+                return new VariableExprNode(n->position(), n->name());
+            });
+        }
+
+        if (auto n = dynamic_cast<const BinaryExprNode*>(&node)) {
+            auto lhs = internNode(*n->lhs());
+            auto rhs = internNode(*n->rhs());
+            return lookup(binaries_, BinaryKey(n->op(), lhs.get(), rhs.get()), [&] {
+                return new BinaryExprNode(n->position(), n->op(), lhs, rhs);
+            });
+        }
+
+        if (auto n = dynamic_cast<const CallExprNode*>(&node)) {
+            std::vector<std::shared_ptr<const ExprNode>> args;
+            CallKey key(n->callee(), std::vector<const ExprNode*>());
+            for (size_t i = 0; i < n->argumentCount(); ++i) {
+                args.push_back(internNode(*n->argument(i)));
+                key.second.push_back(args.back().get());
+            }
+            return lookup(calls_, key, [&] {
+                return new CallExprNode(n->position(), n->callee(), std::move(args));
+            });
+        }
+
+        if (auto n = dynamic_cast<const ReductionExprNode*>(&node)) {
+            auto start = internNode(*n->start());
+            auto end = internNode(*n->end());
+            auto body = internNode(*n->body());
+            const ReductionKey key(n->kind(), n->variable(), start.get(), end.get(), body.get());
+            return lookup(reductions_, key, [&] {
+                return new ReductionExprNode(n->position(), n->kind(), n->variable(), start, end, body);
+            });
+        }
+
+        throw CodegenError(node.position(), "unknown kind of expression");
+    }
+
+}   // namespace kaleidoscope
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+
+namespace kaleidoscope {
+
+    // A hash-consing table of expressions.
+    //
+    // intern() rebuilds an expression tree so that structurally identical subtrees
+    // (same operators, literals, variable names, callees and reductions) become
+    // one shared node, turning the tree into a DAG. Shared nodes keep the position of their
+    // first occurrence, which errors and profile keys report. So that these positions never
+    // point into another function, and so that the table does not grow with the length of
+    // the input, nodes are shared only within the body passed to one call of intern().
+    //
+    // Sharing calls assumes that every function, including `extern` ones, is pure.
+    class ExprTable {
+    public:
+        ExprTable(): numbers_(), variables_(), binaries_(), calls_(), reductions_(), internedCount_(0),
+                     createdCount_(0) {}
+
+        ExprTable(const ExprTable&) = delete;
+        ExprTable& operator=(const ExprTable&) = delete;
+
+        // Hash-cons the body of one function.
+        std::shared_ptr<const ExprNode> intern(const ExprNode& body);
+
+        // Number of nodes passed through intern(), including children.
+        size_t internedCount() const noexcept {
+            return internedCount_;
+        }
+
+        // Number of distinct nodes created by intern().
+        size_t size() const noexcept {
+            return createdCount_;
+        }
+
+    private:
+        typedef std::tuple<Operator, const ExprNode*, const ExprNode*> BinaryKey;
+        typedef std::pair<std::string, std::vector<const ExprNode*>> CallKey;
+        typedef std::tuple<ReductionExprNode::Kind, std::string,
+                           const ExprNode*, const ExprNode*, const ExprNode*> ReductionKey;
+
+        template <class Map, class Key, class Make>
+        std::shared_ptr<const ExprNode> lookup(Map& map, const Key& key, Make make);
+
+        std::shared_ptr<const ExprNode> internNode(const ExprNode& node);
+
+        std::map<uint64_t, std::shared_ptr<ExprNode>> numbers_;
+        std::map<std::string, std::shared_ptr<ExprNode>> variables_;
+        std::map<BinaryKey, std::shared_ptr<ExprNode>> binaries_;
+        std::map<CallKey, std::shared_ptr<ExprNode>> calls_;
+        std::map<ReductionKey, std::shared_ptr<ExprNode>> reductions_;
+        size_t internedCount_;
+        size_t createdCount_;
+    };
+
+}   // namespace kaleidoscope
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <functional>
+
+#include "function_registry.hpp"
+
+namespace kaleidoscope {
+
+    FunctionRegistry::FunctionRegistry():
+        slots_(nullptr), mutex_(), retired_()
+    {
+        for (auto& shard : shards_)
+            shard.store(new Table());
+    }
+
+    FunctionRegistry::~FunctionRegistry()
+    {
+        for (auto& shard : shards_)
+            delete shard.load();
+        for (const Table* table : retired_)
+            delete table;
+        for (Slot* slot = slots_.load(); slot;) {
+            Slot* next = slot->next;
+            delete slot;
+            slot = next;
+        }
+    }
+
+    void FunctionRegistry::publish(const std::string& name, uint64_t address)
+    {
+        std::atomic<const Table*>& shard = shards_[std::hash<std::string>()(name) % kShardCount];
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Table* table = new Table(*shard.load());
+        (*table)[name] = address;
+        retired_.push_back(shard.exchange(table));
+        reclaim();
+    }
+
+    void FunctionRegistry::withdraw(const std::string& name)
+    {
+        std::atomic<const Table*>& shard = shards_[std::hash<std::string>()(name) % kShardCount];
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!shard.load()->count(name))
+            return;
+        Table* table = new Table(*shard.load());
+        table->erase(name);
+        retired_.push_back(shard.exchange(table));
+        reclaim();
+    }
+
+    uint64_t FunctionRegistry::lookup(const std::string& name) const
+    {
+        const std::atomic<const Table*>& shard = shards_[std::hash<std::string>()(name) % kShardCount];
+        Slot* slot = acquireSlot();
+
+        // The table must still be current after it is announced; otherwise a writer
+        // may have missed the announcement and freed it.
+        const Table* table = shard.load();
+        for (;;) {
+            slot->hazard.store(table);
+            const Table* current = shard.load();
+            if (current == table)
+                break;
+            table = current;
+        }
+
+        const auto it = table->find(name);
+        const uint64_t address = it == table->end() ? 0 : it->second;
+
+        slot->hazard.store(nullptr, std::memory_order_release);
+        slot->used.store(false, std::memory_order_release);
+        return address;
+    }
+
+    size_t FunctionRegistry::retiredCount() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return retired_.size();
+    }
+
+    FunctionRegistry::Slot* FunctionRegistry::acquireSlot() const
+    {
+        for (Slot* slot = slots_.load(std::memory_order_acquire); slot; slot = slot->next) {
+            bool used = false;
+            if (!slot->used.load(std::memory_order_relaxed) &&
+                    slot->used.compare_exchange_strong(used, true, std::memory_order_acquire))
+                return slot;
+        }
+
+        // every slot is taken by a concurrent reader; add one
+        Slot* slot = new Slot();
+        slot->used.store(true, std::memory_order_relaxed);
+        Slot* head = slots_.load(std::memory_order_relaxed);
+        do {
+            slot->next = head;
+        } while (!slots_.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+        return slot;
+    }
+
+    void FunctionRegistry::reclaim()
+    {
+        std::vector<const Table*> hazards;
+        for (Slot* slot = slots_.load(std::memory_order_acquire); slot; slot = slot->next) {
+            if (const Table* table = slot->hazard.load())
+                hazards.push_back(table);
+        }
+        std::sort(hazards.begin(), hazards.end());
+
+        auto held = std::partition(retired_.begin(), retired_.end(), [&](const Table* table) {
+            return std::binary_search(hazards.begin(), hazards.end(), table);
+        });
+        for (auto it = held; it != retired_.end(); ++it)
+            delete *it;
+        retired_.erase(held, retired_.end());
+    }
+
+}   // namespace kaleidoscope
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace kaleidoscope {
+
+    // Maps the names of compiled functions to their entry points, for threads
+    // calling them while other functions are still being compiled.
+    //
+    // Lookups take no lock and never wait for a writer. The names are split into
+    // shards, each an immutable table; publishing a name replaces its shard with an
+    // updated copy (read-copy-update), so a reader sees either the old or the new
+    // table, never one being changed. A reader announces the table it is reading in
+    // a hazard slot of its own, and a replaced table is freed only once no slot
+    // holds it. Writers are serialized by a mutex which readers never touch.
+    class FunctionRegistry {
+    public:
+        FunctionRegistry();
+
+        // No lookup may be running.
+        ~FunctionRegistry();
+
+        FunctionRegistry(const FunctionRegistry&) = delete;
+        FunctionRegistry& operator=(const FunctionRegistry&) = delete;
+
+        // Make `address` the entry point of `name`, replacing any earlier one.
+        // Code at the earlier address must stay valid, as readers may still call it.
+        void publish(const std::string& name, uint64_t address);
+
+        // Remove the entry point of `name`, if any.
+        void withdraw(const std::string& name);
+
+        // Returns the entry point of `name`, or 0 if it has not been published.
+        // May be called from any thread, concurrently with publish().
+        uint64_t lookup(const std::string& name) const;
+
+        // Number of tables replaced but not freed yet, because readers may hold them.
+        size_t retiredCount() const;
+
+    private:
+        typedef std::unordered_map<std::string, uint64_t> Table;
+
+        // A hazard pointer. Slots are never freed before the registry, so a list
+        // of them can be walked without locking.
+        struct Slot {
+            Slot(): hazard(nullptr), used(false), next(nullptr) {}
+
+            std::atomic<const Table*> hazard;
+            std::atomic<bool> used;
+            Slot* next;
+        };
+
+        static const size_t kShardCount = 64;
+
+        Slot* acquireSlot() const;
+
+        // Free the retired tables which no slot holds. `mutex_` must be held.
+        void reclaim();
+
+        std::atomic<const Table*> shards_[kShardCount];
+        mutable std::atomic<Slot*> slots_;
+
+        mutable std::mutex mutex_;
+        std::vector<const Table*> retired_;
+    };
+
+}   // namespace kaleidoscope
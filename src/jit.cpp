@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Analysis/TargetTransformInfo.h>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+#include <llvm/ExecutionEngine/Orc/LambdaResolver.h>
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Mangler.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/IPO/PassManagerBuilder.h>
+
+#include "jit.hpp"
+#include "memory_profile.hpp"
+
+namespace {
+
+    using namespace kaleidoscope;
+
+    // The host CPU and the libraries of the process do not change, so what is found out
+    // about them is kept for every later Jit, such as those of the sessions of a server.
+    // A TargetMachine is not shared: code generation may not use one from several threads.
+    struct HostCpu {
+        std::string name;
+        std::vector<std::string> attributes;
+        bool hasAvx2;
+    };
+
+    const HostCpu& hostCpu()
+    {
+        static const HostCpu cpu = [] {
+            HostCpu cpu { llvm::sys::getHostCPUName().str(), {}, false };
+            llvm::StringMap<bool> features;
+            if (llvm::sys::getHostCPUFeatures(features)) {
+                for (const auto& feature : features)
+                    cpu.attributes.push_back((feature.getValue() ? "+" : "-") + feature.getKey().str());
+                cpu.hasAvx2 = features.lookup("avx2");
+            }
+            return cpu;
+        }();
+        return cpu;
+    }
+
+    // Load the shared library `filename` into the process unless done before.
+    // Returns false with a message in `error` if it cannot be loaded.
+    bool loadLibraryOnce(const char* filename, std::string* error)
+    {
+        static std::mutex mutex;
+        static std::map<std::string, std::string> errors;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = errors.find(filename);
+        if (it == errors.end()) {
+            std::string message;
+            if (llvm::sys::DynamicLibrary::LoadLibraryPermanently(filename, &message) && message.empty())
+                message = "cannot load it";
+            it = errors.emplace(filename, message).first;
+        }
+        *error = it->second;
+        return error->empty();
+    }
+
+    llvm::TargetMachine* createTargetMachine(const Options& options)
+    {
+        llvm::TargetOptions targetOptions;
+        switch (options.fpMode) {
+        case FloatingPointMode::Strict:
+            targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Strict;
+            break;
+        case FloatingPointMode::Contract:
+            targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+            break;
+        case FloatingPointMode::Fast:
+            targetOptions.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+            targetOptions.UnsafeFPMath = true;
+            break;
+        }
+
+        llvm::EngineBuilder builder;
+        builder.setTargetOptions(targetOptions);
+        builder.setOptLevel(llvm::CodeGenOpt::Aggressive);
+
+        if (options.tuneForHost) {
+            // Without explicit features the target machine assumes a baseline
+            // CPU and never uses FMA or AVX.
+            builder.setMCPU(hostCpu().name);
+            builder.setMAttrs(hostCpu().attributes);
+        }
+
+        return builder.selectTarget();
+    }
+
+    // Vector variants of libm functions. Both the libm name and the intrinsic
+    // are listed because calls to `extern`ed math functions become intrinsics.
+    const llvm::VecDesc kLibmvecSse[] = {
+        { "sin", "_ZGVbN2v_sin", 2 },  { "llvm.sin.f64", "_ZGVbN2v_sin", 2 },
+        { "cos", "_ZGVbN2v_cos", 2 },  { "llvm.cos.f64", "_ZGVbN2v_cos", 2 },
+        { "exp", "_ZGVbN2v_exp", 2 },  { "llvm.exp.f64", "_ZGVbN2v_exp", 2 },
+        { "log", "_ZGVbN2v_log", 2 },  { "llvm.log.f64", "_ZGVbN2v_log", 2 },
+        { "pow", "_ZGVbN2vv_pow", 2 }, { "llvm.pow.f64", "_ZGVbN2vv_pow", 2 },
+    };
+
+    const llvm::VecDesc kLibmvecAvx2[] = {
+        { "sin", "_ZGVdN4v_sin", 4 },  { "llvm.sin.f64", "_ZGVdN4v_sin", 4 },
+        { "cos", "_ZGVdN4v_cos", 4 },  { "llvm.cos.f64", "_ZGVdN4v_cos", 4 },
+        { "exp", "_ZGVdN4v_exp", 4 },  { "llvm.exp.f64", "_ZGVdN4v_exp", 4 },
+        { "log", "_ZGVdN4v_log", 4 },  { "llvm.log.f64", "_ZGVdN4v_log", 4 },
+        { "pow", "_ZGVdN4vv_pow", 4 }, { "llvm.pow.f64", "_ZGVdN4vv_pow", 4 },
+    };
+
+    const llvm::VecDesc kSleef[] = {
+        { "sin",   "Sleef_sind2_u10",   2 }, { "llvm.sin.f64",   "Sleef_sind2_u10",   2 },
+        { "cos",   "Sleef_cosd2_u10",   2 }, { "llvm.cos.f64",   "Sleef_cosd2_u10",   2 },
+        { "exp",   "Sleef_expd2_u10",   2 }, { "llvm.exp.f64",   "Sleef_expd2_u10",   2 },
+        { "exp2",  "Sleef_exp2d2_u10",  2 }, { "llvm.exp2.f64",  "Sleef_exp2d2_u10",  2 },
+        { "log",   "Sleef_logd2_u10",   2 }, { "llvm.log.f64",   "Sleef_logd2_u10",   2 },
+        { "log10", "Sleef_log10d2_u10", 2 }, { "llvm.log10.f64", "Sleef_log10d2_u10", 2 },
+        { "pow",   "Sleef_powd2_u10",   2 }, { "llvm.pow.f64",   "Sleef_powd2_u10",   2 },
+        { "sin",   "Sleef_sind4_u10",   4 }, { "llvm.sin.f64",   "Sleef_sind4_u10",   4 },
+        { "cos",   "Sleef_cosd4_u10",   4 }, { "llvm.cos.f64",   "Sleef_cosd4_u10",   4 },
+        { "exp",   "Sleef_expd4_u10",   4 }, { "llvm.exp.f64",   "Sleef_expd4_u10",   4 },
+        { "exp2",  "Sleef_exp2d4_u10",  4 }, { "llvm.exp2.f64",  "Sleef_exp2d4_u10",  4 },
+        { "log",   "Sleef_logd4_u10",   4 }, { "llvm.log.f64",   "Sleef_logd4_u10",   4 },
+        { "log10", "Sleef_log10d4_u10", 4 }, { "llvm.log10.f64", "Sleef_log10d4_u10", 4 },
+        { "pow",   "Sleef_powd4_u10",   4 }, { "llvm.pow.f64",   "Sleef_powd4_u10",   4 },
+    };
+
+    // Load the vector library selected by `options` into the process and return its functions.
+    // Falls back to no vector library if it is not installed.
+    std::vector<llvm::VecDesc> loadVectorLibrary(const Options& options)
+    {
+        std::vector<llvm::VecDesc> functions;
+        std::string error;
+
+        switch (options.vectorLibrary) {
+        case VectorLibrary::None:
+            break;
+        case VectorLibrary::Libmvec:
+            if (!loadLibraryOnce("libmvec.so.1", &error)) {
+                std::cerr << "warning: libmvec is not available: " << error << std::endl;
+                break;
+            }
+            functions.insert(functions.end(), std::begin(kLibmvecSse), std::end(kLibmvecSse));
+            // the 4-wide variants need AVX2, which the target machine only uses with --mcpu=native
+            if (options.tuneForHost && hostCpu().hasAvx2)
+                functions.insert(functions.end(), std::begin(kLibmvecAvx2), std::end(kLibmvecAvx2));
+            break;
+        case VectorLibrary::Sleef:
+            if (!loadLibraryOnce("libsleef.so.3", &error)) {
+                std::cerr << "warning: SLEEF is not available: " << error << std::endl;
+                break;
+            }
+            // SLEEF dispatches to the best implementation at run time
+            functions.insert(functions.end(), std::begin(kSleef), std::end(kSleef));
+            break;
+        }
+
+        return functions;
+    }
+
+}   // namespace anonymous
+
+
+namespace kaleidoscope {
+
+    Jit::Jit(const Options& options):
+        targetMachine_(createTargetMachine(options)),
+        dataLayout_(targetMachine_->createDataLayout()),
+        memory_(options.jitHugePages),
+        objectLayer_(),
+        compileLayer_(objectLayer_, llvm::orc::SimpleCompiler(*targetMachine_)),
+        moduleHandles_(),
+        registry_(),
+        vectorFunctions_()
+    {
+        // make functions of the host process (e.g. sin in libm) callable
+        llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+        vectorFunctions_ = loadVectorLibrary(options);
+    }
+
+    Jit::ModuleHandle Jit::addModule(std::unique_ptr<llvm::Module> module, JitMemory::Pool pool)
+    {
+        const PhaseScope phase(Phase::Compile);
+        prepare(*module, pool);
+        return addPreparedModule(std::move(module), pool);
+    }
+
+    Jit::ModuleHandle Jit::addDefinitions(std::unique_ptr<llvm::Module> module,
+                                          const std::vector<std::string>& names,
+                                          JitMemory::Pool pool)
+    {
+        const PhaseScope phase(Phase::Compile);
+        prepare(*module, pool);
+        const bool linkable = canResolveCalls(*module);
+        const ModuleHandle handle = addPreparedModule(std::move(module), pool);
+
+        for (const auto& name : names) {
+            const std::string symbolName = mangle(name);
+            auto symbol = compileLayer_.findSymbolIn(handle, symbolName, true);
+            if (linkable && symbol)
+                registry_.publish(symbolName, symbol.getAddress());
+            else
+                registry_.withdraw(symbolName);
+        }
+        return handle;
+    }
+
+    void Jit::prepare(llvm::Module& module, JitMemory::Pool pool)
+    {
+        module.setDataLayout(dataLayout_);
+        module.setTargetTriple(targetMachine_->getTargetTriple().str());
+        optimize(module, pool == JitMemory::Hot);
+    }
+
+    Jit::ModuleHandle Jit::addPreparedModule(std::unique_ptr<llvm::Module> module, JitMemory::Pool pool)
+    {
+        auto resolver = llvm::orc::createLambdaResolver(
+            [this](const std::string& name) {
+                if (auto symbol = findMangledSymbol(name))
+                    return llvm::RuntimeDyld::SymbolInfo(symbol.getAddress(), symbol.getFlags());
+                return llvm::RuntimeDyld::SymbolInfo(nullptr);
+            },
+            [](const std::string&) {
+                return llvm::RuntimeDyld::SymbolInfo(nullptr);
+            });
+
+        std::vector<std::unique_ptr<llvm::Module>> modules;
+        modules.push_back(std::move(module));
+        auto handle = compileLayer_.addModuleSet(
+            std::move(modules),
+            memory_.createMemoryManager(pool),
+            std::move(resolver));
+        moduleHandles_.push_back(handle);
+        return handle;
+    }
+
+    void Jit::removeModule(ModuleHandle handle)
+    {
+        moduleHandles_.erase(std::find(moduleHandles_.begin(), moduleHandles_.end(), handle));
+        compileLayer_.removeModuleSet(handle);
+    }
+
+    uint64_t Jit::getFunctionAddress(ModuleHandle handle, const std::string& name)
+    {
+        auto symbol = compileLayer_.findSymbolIn(handle, mangle(name), true);
+        return symbol ? symbol.getAddress() : 0;
+    }
+
+    bool Jit::emitObject(llvm::Module& module, std::ostream& out)
+    {
+        const PhaseScope phase(Phase::Compile);
+        module.setDataLayout(dataLayout_);
+        module.setTargetTriple(targetMachine_->getTargetTriple().str());
+        optimize(module, false);
+
+        llvm::SmallVector<char, 0> buffer;
+        llvm::raw_svector_ostream stream(buffer);
+        llvm::legacy::PassManager passes;
+        if (targetMachine_->addPassesToEmitFile(passes, stream, llvm::TargetMachine::CGFT_ObjectFile))
+            return false;
+        passes.run(module);
+        out.write(buffer.data(), buffer.size());
+        return true;
+    }
+
+    void Jit::optimize(llvm::Module& module, bool hot)
+    {
+        llvm::PassManagerBuilder builder;
+        builder.OptLevel = 3;
+        builder.Inliner = llvm::createFunctionInliningPass(hot ? 1000 : 275);
+        builder.LoopVectorize = true;
+        builder.SLPVectorize = true;
+
+        // PassManagerBuilder takes the ownership
+        auto libraryInfo = new llvm::TargetLibraryInfoImpl(targetMachine_->getTargetTriple());
+        libraryInfo->addVectorizableFunctions(vectorFunctions_);
+        builder.LibraryInfo = libraryInfo;
+
+        llvm::legacy::FunctionPassManager functionPasses(&module);
+        functionPasses.add(llvm::createTargetTransformInfoWrapperPass(targetMachine_->getTargetIRAnalysis()));
+        builder.populateFunctionPassManager(functionPasses);
+
+        llvm::legacy::PassManager modulePasses;
+        modulePasses.add(llvm::createTargetTransformInfoWrapperPass(targetMachine_->getTargetIRAnalysis()));
+        builder.populateModulePassManager(modulePasses);
+
+        functionPasses.doInitialization();
+        for (auto& f : module)
+            functionPasses.run(f);
+        functionPasses.doFinalization();
+        modulePasses.run(module);
+    }
+
+    // Linking a module resolves the functions it calls, and the object layer aborts if
+    // one cannot be found. Unpublished definitions may not be linkable themselves, so
+    // only published functions and those of the process count.
+    bool Jit::canResolveCalls(const llvm::Module& module) const
+    {
+        for (const auto& f : module) {
+            if (!f.isDeclaration() || f.isIntrinsic() || f.use_empty())
+                continue;
+            const std::string symbolName = mangle(f.getName().str());
+            if (!registry_.lookup(symbolName) &&
+                    !llvm::RTDyldMemoryManager::getSymbolAddressInProcess(symbolName))
+                return false;
+        }
+        return true;
+    }
+
+    bool Jit::hasProcessSymbol(const std::string& name) const
+    {
+        return llvm::RTDyldMemoryManager::getSymbolAddressInProcess(mangle(name)) != 0;
+    }
+
+    llvm::orc::JITSymbol Jit::findMangledSymbol(const std::string& name)
+    {
+        // published functions are the newest definitions of their names
+        if (auto address = registry_.lookup(name))
+            return llvm::orc::JITSymbol(address, llvm::JITSymbolFlags::Exported);
+
+        // search from the newest module so that redefinitions win
+        for (auto it = moduleHandles_.rbegin(); it != moduleHandles_.rend(); ++it) {
+            if (auto symbol = compileLayer_.findSymbolIn(*it, name, true))
+                return symbol;
+        }
+
+        if (auto address = llvm::RTDyldMemoryManager::getSymbolAddressInProcess(name))
+            return llvm::orc::JITSymbol(address, llvm::JITSymbolFlags::Exported);
+
+        return nullptr;
+    }
+
+    std::string Jit::mangle(const std::string& name) const
+    {
+        std::string mangledName;
+        llvm::raw_string_ostream stream(mangledName);
+        llvm::Mangler::getNameWithPrefix(stream, name, dataLayout_);
+        return stream.str();
+    }
+
+}   // namespace kaleidoscope
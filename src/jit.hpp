@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/JITSymbol.h>
+#include <llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include "function_registry.hpp"
+#include "jit_memory.hpp"
+#include "options.hpp"
+
+namespace kaleidoscope {
+
+    // A just-in-time compiler which optimizes and compiles whole modules
+    // for the machine it is running on.
+    // llvm::InitializeNativeTarget() must be called before constructing it.
+    class Jit {
+    private:
+        typedef llvm::orc::ObjectLinkingLayer<> ObjectLayer;
+        typedef llvm::orc::IRCompileLayer<ObjectLayer> CompileLayer;
+
+    public:
+        typedef CompileLayer::ModuleSetHandleT ModuleHandle;
+
+        explicit Jit(const Options& options);
+
+        Jit(const Jit&) = delete;
+        Jit& operator=(const Jit&) = delete;
+
+        const llvm::DataLayout& dataLayout() const noexcept {
+            return dataLayout_;
+        }
+
+        // Optimize `module` and compile it to machine code into memory from `pool`.
+        // Functions defined by later modules hide the ones with the same name.
+        // Hot modules are optimized for speed regardless of code size.
+        ModuleHandle addModule(std::unique_ptr<llvm::Module> module,
+                               JitMemory::Pool pool = JitMemory::Persistent);
+
+        // Free the machine code of the module `handle`.
+        // Its functions must not be running or be called afterwards.
+        // Modules with published functions must not be removed.
+        void removeModule(ModuleHandle handle);
+
+        // Add `module` as addModule() does, as the newest definition of the functions `names`.
+        // If every function it calls can already be resolved, the module is linked at once
+        // and `names` are published for lookup(). Otherwise it is linked on the first use
+        // of one of its functions like other modules, since linking it now would fail,
+        // and `names` are withdrawn so that lookup() does not return older definitions.
+        ModuleHandle addDefinitions(std::unique_ptr<llvm::Module> module,
+                                    const std::vector<std::string>& names,
+                                    JitMemory::Pool pool = JitMemory::Persistent);
+
+        // Returns the address of the published function whose symbol is `symbolName`,
+        // or 0 if there is none. Unlike the other members, this may be called from any
+        // thread at any time; it takes no lock and is not held up by compilation.
+        uint64_t lookup(const std::string& symbolName) const {
+            return registry_.lookup(symbolName);
+        }
+
+        // Returns true if the process defines the function `name`, e.g. sin in libm,
+        // so that calls to it can be linked without a definition in the JIT.
+        bool hasProcessSymbol(const std::string& name) const;
+
+        // Returns the symbol of the function `name`, for lookup().
+        std::string mangle(const std::string& name) const;
+
+        // Returns the address of the function `name` defined in the module `handle`,
+        // or 0 if there is no such function.
+        uint64_t getFunctionAddress(ModuleHandle handle, const std::string& name);
+
+        JitMemory::Stats memoryStats() const {
+            return memory_.stats();
+        }
+
+        // Optimize `module` as addModule() does and write it to `out` as a
+        // relocatable object file instead of loading it.
+        // Returns false if the target cannot emit object files.
+        bool emitObject(llvm::Module& module, std::ostream& out);
+
+    private:
+        void prepare(llvm::Module& module, JitMemory::Pool pool);
+        ModuleHandle addPreparedModule(std::unique_ptr<llvm::Module> module, JitMemory::Pool pool);
+        bool canResolveCalls(const llvm::Module& module) const;
+        void optimize(llvm::Module& module, bool hot);
+        llvm::orc::JITSymbol findMangledSymbol(const std::string& name);
+
+        std::unique_ptr<llvm::TargetMachine> targetMachine_;
+        const llvm::DataLayout dataLayout_;
+
+        // must outlive the object layer, which owns memory managers allocating from it
+        JitMemory memory_;
+
+        ObjectLayer objectLayer_;
+        CompileLayer compileLayer_;
+        std::vector<ModuleHandle> moduleHandles_;
+
+        // published functions, by mangled name
+        FunctionRegistry registry_;
+
+        // SIMD math functions the vectorizer may call
+        std::vector<llvm::VecDesc> vectorFunctions_;
+    };
+
+}   // namespace kaleidoscope
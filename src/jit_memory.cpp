@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <string>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <llvm/Support/Memory.h>
+
+#include "jit_memory.hpp"
+
+namespace {
+
+    // Slabs are only address space until touched, so they can be generous.
+    const size_t kSlabSize = 8 * 1024 * 1024;
+
+    size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+}   // anonymous namespace
+
+
+namespace kaleidoscope {
+
+    // Allocates the sections of one module set from a JitMemory and gives them
+    // back when the module set is removed.
+    class JitMemory::MemoryManager: public llvm::RTDyldMemoryManager {
+    public:
+        MemoryManager(JitMemory& memory, Pool pool):
+            memory_(memory), pool_(pool), runs_(), allocations_(), ehFrames_() {}
+
+        ~MemoryManager() override {
+            // The unwinder reads registered frames on every throw, so they must go
+            // before their memory is reused or unmapped.
+            for (const EhFrame& frame : ehFrames_)
+                RTDyldMemoryManager::deregisterEHFrames(frame.addr, frame.loadAddr, frame.size);
+            for (const auto& allocation : allocations_)
+                memory_.release(allocation.first, allocation.second);
+        }
+
+        MemoryManager(const MemoryManager&) = delete;
+        MemoryManager& operator=(const MemoryManager&) = delete;
+
+        uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment, unsigned,
+                                     llvm::StringRef) override {
+            return allocate(Code, size, alignment);
+        }
+
+        uint8_t* allocateDataSection(uintptr_t size, unsigned alignment, unsigned,
+                                     llvm::StringRef, bool isReadOnly) override {
+            return allocate(isReadOnly ? ReadOnly : ReadWrite, size, alignment);
+        }
+
+        bool finalizeMemory(std::string* errorMessage) override {
+            for (const Run& run : runs_) {
+                if (run.access == ReadWrite)
+                    continue;
+                if (!memory_.protect(run.slab, run.begin, run.end, run.access)) {
+                    if (errorMessage)
+                        *errorMessage = "mprotect failed";
+                    return true;
+                }
+                if (run.access == Code)
+                    llvm::sys::Memory::InvalidateInstructionCache(run.slab->base + run.begin, run.end - run.begin);
+            }
+            runs_.clear();
+            return false;
+        }
+
+        void registerEHFrames(uint8_t* addr, uint64_t loadAddr, size_t size) override {
+            RTDyldMemoryManager::registerEHFrames(addr, loadAddr, size);
+            ehFrames_.push_back(EhFrame { addr, loadAddr, size });
+        }
+
+    private:
+        // Consecutive sections of one kind in one slab, protected together.
+        struct Run {
+            Access access;
+            Slab* slab;
+            size_t begin;
+            size_t end;
+        };
+
+        struct EhFrame {
+            uint8_t* addr;
+            uint64_t loadAddr;
+            size_t size;
+        };
+
+        uint8_t* allocate(Access access, uintptr_t size, unsigned alignment) {
+            Run* run = nullptr;
+            for (Run& r : runs_) {
+                if (r.access == access)
+                    run = &r;
+            }
+
+            // Pages whose permissions change are not shared with other module sets,
+            // which may be finalized at a different time.
+            const bool newPage = access != ReadWrite && !run;
+
+            Slab* slab;
+            uint8_t* p = memory_.allocate(pool_, access, size, alignment, newPage, &slab);
+            if (!p)
+                return nullptr;
+            allocations_.emplace_back(slab, size);
+
+            const size_t offset = p - slab->base;
+            if (run && run->slab == slab) {
+                run->end = offset + size;
+            } else {
+                runs_.push_back(Run { access, slab, offset, offset + size });
+            }
+            return p;
+        }
+
+        JitMemory& memory_;
+        const Pool pool_;
+        std::vector<Run> runs_;
+        std::vector<std::pair<Slab*, size_t>> allocations_;
+        std::vector<EhFrame> ehFrames_;
+    };
+
+
+    JitMemory::JitMemory(bool hugePages):
+        hugePages_(hugePages),
+        pageSize_(::sysconf(_SC_PAGESIZE)),
+        slabs_(),
+        current_(),
+        mmapCalls_(0),
+        mprotectCalls_(0) {}
+
+    JitMemory::~JitMemory()
+    {
+        for (const auto& slab : slabs_)
+            ::munmap(slab->base, slab->size);
+    }
+
+    std::unique_ptr<llvm::RTDyldMemoryManager> JitMemory::createMemoryManager(Pool pool)
+    {
+        return std::unique_ptr<llvm::RTDyldMemoryManager>(new MemoryManager(*this, pool));
+    }
+
+    JitMemory::Stats JitMemory::stats() const
+    {
+        Stats stats = Stats();
+        for (const auto& slab : slabs_) {
+            stats.reservedBytes += slab->size;
+            stats.usedBytes += slab->live;
+            stats.wastedBytes += slab->top - slab->live;
+        }
+        stats.mmapCalls = mmapCalls_;
+        stats.mprotectCalls = mprotectCalls_;
+        return stats;
+    }
+
+    uint8_t* JitMemory::allocate(Pool pool, Access access, size_t size, unsigned alignment, bool newPage,
+                                 Slab** slab)
+    {
+        const size_t align = newPage ? std::max<size_t>(pageSize_, alignment) : std::max(16u, alignment);
+        Slab*& current = current_[pool][access];
+
+        size_t offset = current ? alignUp(std::max(current->top, current->protectedEnd), align) : 0;
+        if (!current || offset + size > current->size) {
+            Slab* full = current;
+            current = mapSlab(std::max(kSlabSize, alignUp(size, pageSize_)));
+            if (full && full->live == 0)
+                unmapSlab(full);
+            if (!current)
+                return nullptr;
+            offset = 0;
+        }
+
+        current->top = offset + size;
+        current->live += size;
+        *slab = current;
+        return current->base + offset;
+    }
+
+    void JitMemory::release(Slab* slab, size_t size)
+    {
+        slab->live -= size;
+        if (slab->live != 0)
+            return;
+
+        for (auto& pools : current_) {
+            for (Slab* current : pools) {
+                if (current != slab)
+                    continue;
+                // Reuse the slab from its start; a single call makes it writable again.
+                if (slab->protectedEnd != 0) {
+                    ++mprotectCalls_;
+                    ::mprotect(slab->base, slab->protectedEnd, PROT_READ | PROT_WRITE);
+                }
+                slab->top = 0;
+                slab->protectedEnd = 0;
+                return;
+            }
+        }
+        unmapSlab(slab);
+    }
+
+    bool JitMemory::protect(Slab* slab, size_t begin, size_t end, Access access)
+    {
+        end = alignUp(end, pageSize_);
+        ++mprotectCalls_;
+        const int protection = access == Code ? PROT_READ | PROT_EXEC : PROT_READ;
+        if (::mprotect(slab->base + begin, end - begin, protection) != 0)
+            return false;
+        slab->protectedEnd = std::max(slab->protectedEnd, end);
+        return true;
+    }
+
+    JitMemory::Slab* JitMemory::mapSlab(size_t size)
+    {
+        ++mmapCalls_;
+        void* base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+            return nullptr;
+        if (hugePages_)
+            ::madvise(base, size, MADV_HUGEPAGE);
+
+        slabs_.emplace_back(new Slab { static_cast<uint8_t*>(base), size, 0, 0, 0 });
+        return slabs_.back().get();
+    }
+
+    void JitMemory::unmapSlab(Slab* slab)
+    {
+        ::munmap(slab->base, slab->size);
+        slabs_.erase(std::find_if(slabs_.begin(), slabs_.end(),
+                                  [slab](const std::unique_ptr<Slab>& s) { return s.get() == slab; }));
+    }
+
+}   // namespace kaleidoscope
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <llvm/ExecutionEngine/RTDyldMemoryManager.h>
+
+namespace kaleidoscope {
+
+    // Memory for JIT-compiled code and data, carved out of large slabs.
+    //
+    // Every module set loaded by the JIT gets a memory manager of its own from
+    // createMemoryManager(), but all of them allocate from the slabs of one JitMemory,
+    // so loading a module maps no memory unless a slab is full. The sections of a
+    // module are placed one after another, so making them executable or read-only
+    // takes one mprotect per kind of section rather than one per section.
+    // A slab is reused once all the module sets in it have been removed.
+    class JitMemory {
+    public:
+        // Where the memory of a module set comes from.
+        enum Pool {
+            // code kept for the whole session
+            Persistent,
+            // code removed soon after it is loaded, e.g. top-level expressions
+            Transient,
+            // recompiled hot functions, kept together for i-cache and TLB locality
+            Hot,
+        };
+
+        struct Stats {
+            // bytes mapped for slabs
+            size_t reservedBytes;
+            // bytes of the sections of loaded module sets
+            size_t usedBytes;
+            // bytes lost to alignment, page rounding and removed module sets in slabs still in use
+            size_t wastedBytes;
+            size_t mmapCalls;
+            size_t mprotectCalls;
+        };
+
+        // If `hugePages` is true, slabs are advised to be backed by transparent huge pages.
+        explicit JitMemory(bool hugePages);
+        ~JitMemory();
+
+        JitMemory(const JitMemory&) = delete;
+        JitMemory& operator=(const JitMemory&) = delete;
+
+        // Returns a memory manager for one module set. It must be destroyed before this object.
+        std::unique_ptr<llvm::RTDyldMemoryManager> createMemoryManager(Pool pool);
+
+        Stats stats() const;
+
+    private:
+        class MemoryManager;
+
+        enum Access { Code, ReadOnly, ReadWrite };
+        static const size_t kPoolCount = 3;
+        static const size_t kAccessCount = 3;
+
+        struct Slab {
+            uint8_t* base;
+            size_t size;
+            // offset of the first byte not allocated
+            size_t top;
+            // end of the pages whose permissions have been changed
+            size_t protectedEnd;
+            // bytes allocated to module sets which are still loaded
+            size_t live;
+        };
+
+        // Allocate `size` bytes from the current slab for `pool` and `access`.
+        // If `newPage` is true, the allocation starts on a page of its own.
+        // Returns nullptr if no memory can be mapped.
+        uint8_t* allocate(Pool pool, Access access, size_t size, unsigned alignment, bool newPage, Slab** slab);
+
+        // Give back `size` bytes allocated from `slab`, recycling the slab once it is unused.
+        void release(Slab* slab, size_t size);
+
+        bool protect(Slab* slab, size_t begin, size_t end, Access access);
+
+        Slab* mapSlab(size_t size);
+        void unmapSlab(Slab* slab);
+
+        const bool hugePages_;
+        const size_t pageSize_;
+        std::vector<std::unique_ptr<Slab>> slabs_;
+        Slab* current_[kPoolCount][kAccessCount];
+        size_t mmapCalls_;
+        size_t mprotectCalls_;
+    };
+
+}   // namespace kaleidoscope
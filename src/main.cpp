@@ -1,27 +1,239 @@
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <sstream>
+#include <streambuf>
+#include <string>
 #include <vector>
+#include <unistd.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/TargetSelect.h>
 #include "token.hpp"
 #include "ast.hpp"
+#include "memory_profile.hpp"
+#include "options.hpp"
+#include "server.hpp"
 
 using namespace kaleidoscope;
 
-int main()
+namespace {
+
+    const size_t kEmitBufferSize = 1 << 20;
+
+    // Writes to a file descriptor through a buffer of a given size. Used for
+    // standard output, since std::cout cannot portably be given a larger buffer
+    // and reopening it by path would truncate files and fail on sockets.
+    class FdOutputBuffer: public std::streambuf {
+    public:
+        FdOutputBuffer(int fd, size_t size): fd_(fd), buffer_(size) {
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+        }
+
+        ~FdOutputBuffer() {
+            sync();
+        }
+
+    protected:
+        int_type overflow(int_type ch) override {
+            if (sync() != 0)
+                return traits_type::eof();
+            if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(ch);
+                pbump(1);
+            }
+            return traits_type::not_eof(ch);
+        }
+
+        // Returns -1, dropping the buffered output, if it cannot be written.
+        int sync() override {
+            const char* p = pbase();
+            int result = 0;
+            while (p < pptr()) {
+                const ssize_t written = ::write(fd_, p, pptr() - p);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0) {
+                    result = -1;
+                    break;
+                }
+                p += written;
+            }
+            setp(buffer_.data(), buffer_.data() + buffer_.size());
+            return result;
+        }
+
+    private:
+        int fd_;
+        std::vector<char> buffer_;
+    };
+
+    void printUsage(const char* program)
+    {
+        std::cerr << "Usage: " << program << " [options] < input.ks\n"
+                  << "       " << program << " [options] --server=SOCKET\n"
+                  << "Options:\n"
+                  << "  --fp-mode=strict|contract|fast  floating-point semantics (default: strict)\n"
+                  << "  --mcpu=native                   generate code for the host CPU\n"
+                  << "  --veclib=none|libmvec|sleef     SIMD math library (default: libmvec)\n"
+                  << "  --profile                       count calls and reoptimize hot functions\n"
+                  << "  --profile-out=FILE              write the profile to FILE (implies --profile)\n"
+                  << "  --hot-threshold=N               calls before a function is hot (default: 10000)\n"
+                  << "  --hash-cons                     share identical subexpressions (assumes pure externs)\n"
+                  << "  --specialize=N                  specialize functions called N times with the same constants\n"
+                  << "  --specialize-budget=N           expression nodes allowed in specializations (default: 10000)\n"
+                  << "  --pipeline                      lex, parse, compile and evaluate on separate threads\n"
+                  << "  --jobs=N                        evaluate top-level expressions on N threads\n"
+                  << "  --jit-huge-pages                back JIT-compiled code with huge pages\n"
+                  << "  --jit-stats                     print JIT memory statistics at the end\n"
+                  << "  --memory-profile                print allocations per phase and peak memory at the end\n"
+                  << "  --emit=MODE                     trace|none|tokens|ast|llvm-ir|bitcode|obj (default: trace)\n"
+                  << "  --output=FILE                   write emitted output to FILE instead of stdout\n"
+                  << "  --server=SOCKET                 serve programs sent to the Unix domain socket\n"
+                  << "  --server-sessions=N             sessions the server runs at once (default: 16)\n";
+    }
+
+    bool parseOptions(int argc, char** argv, Options* options, std::string* serverPath, unsigned* serverSessions)
+    {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg.compare(0, 10, "--fp-mode=") == 0) {
+                if (!parseFloatingPointMode(arg.substr(10), &options->fpMode))
+                    return false;
+            } else if (arg.compare(0, 9, "--veclib=") == 0) {
+                if (!parseVectorLibrary(arg.substr(9), &options->vectorLibrary))
+                    return false;
+            } else if (arg == "--profile") {
+                options->profile = true;
+            } else if (arg.compare(0, 14, "--profile-out=") == 0) {
+                options->profile = true;
+                options->profileOutput = arg.substr(14);
+            } else if (arg.compare(0, 16, "--hot-threshold=") == 0) {
+                char* end;
+                options->hotThreshold = std::strtoull(arg.c_str() + 16, &end, 10);
+                if (*end != '\0' || end == arg.c_str() + 16)
+                    return false;
+            } else if (arg == "--hash-cons") {
+                options->hashCons = true;
+            } else if (arg.compare(0, 13, "--specialize=") == 0) {
+                char* end;
+                options->specializeThreshold = std::strtoul(arg.c_str() + 13, &end, 10);
+                if (*end != '\0' || end == arg.c_str() + 13)
+                    return false;
+            } else if (arg.compare(0, 20, "--specialize-budget=") == 0) {
+                char* end;
+                options->specializeBudget = std::strtoull(arg.c_str() + 20, &end, 10);
+                if (*end != '\0' || end == arg.c_str() + 20)
+                    return false;
+            } else if (arg.compare(0, 7, "--jobs=") == 0) {
+                char* end;
+                options->jobs = std::strtoul(arg.c_str() + 7, &end, 10);
+                if (*end != '\0' || options->jobs == 0)
+                    return false;
+            } else if (arg == "--pipeline") {
+                options->pipeline = true;
+            } else if (arg == "--jit-huge-pages") {
+                options->jitHugePages = true;
+            } else if (arg == "--jit-stats") {
+                options->jitStats = true;
+            } else if (arg == "--memory-profile") {
+                options->memoryProfile = true;
+            } else if (arg.compare(0, 7, "--emit=") == 0) {
+                if (!parseEmitMode(arg.substr(7), &options->emit))
+                    return false;
+            } else if (arg.compare(0, 9, "--output=") == 0) {
+                options->emitOutput = arg.substr(9);
+            } else if (arg.compare(0, 9, "--server=") == 0) {
+                *serverPath = arg.substr(9);
+            } else if (arg.compare(0, 18, "--server-sessions=") == 0) {
+                char* end;
+                *serverSessions = std::strtoul(arg.c_str() + 18, &end, 10);
+                if (*end != '\0' || *serverSessions == 0)
+                    return false;
+            } else if (arg == "--mcpu=native") {
+                options->tuneForHost = true;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}   // anonymous namespace
+
+int main(int argc, char** argv)
 {
-    std::istreambuf_iterator<char> first(std::cin);
-    std::istreambuf_iterator<char> last;
+    Options options;
+    std::string serverPath;
+    unsigned serverSessions = 16;
+    if (!parseOptions(argc, argv, &options, &serverPath, &serverSessions)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    if (!serverPath.empty())
+        return runServer(serverPath, options, serverSessions) ? 0 : 1;
+
+    // The memory profile is reported per byte of input, so the input is read
+    // in full before counting starts.
+    std::istringstream source;
+    size_t sourceBytes = 0;
+    if (options.memoryProfile) {
+        source.str(std::string(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>()));
+        sourceBytes = source.str().size();
+        MemoryProfile::enable();
+    }
 
+    std::istream& input = options.memoryProfile ? source : std::cin;
     std::string filename = "stdin";
-    auto tokens = tokenize(first, last, filename);
 
-    std::cout << "Tokens:";
-    for (auto i = tokens.begin(); i != tokens.end(); ++i) {
-        std::cout << " " << (*i)->toString();
+    // Emitted output can be much larger than the input, so it goes through
+    // one large buffer rather than std::cout, which is synchronized with stdio.
+    std::vector<char> buffer(kEmitBufferSize);
+    std::ofstream file;
+    FdOutputBuffer stdoutBuffer(STDOUT_FILENO, options.emitOutput.empty() ? kEmitBufferSize : 1);
+    std::ostream stdoutStream(&stdoutBuffer);
+    if (!options.emitOutput.empty()) {
+        file.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        file.open(options.emitOutput, std::ios::out | std::ios::binary);
+        if (!file) {
+            std::cerr << "Cannot open " << options.emitOutput << std::endl;
+            return 1;
+        }
     }
-    std::cout << std::endl;
+    std::ostream& emit = options.emitOutput.empty() ? stdoutStream : file;
 
-    auto it = std::begin(tokens);
+    llvm::LLVMContext llvmContext;
+    if (options.pipeline) {
+        parseAndPrintPipelined(input, filename, options, llvmContext, std::cerr, emit);
+    } else {
+        auto tokens = tokenize(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), filename);
 
-    parseAndPrint(it);
+        if (options.emit == EmitMode::Trace || options.emit == EmitMode::Tokens) {
+            emit << "Tokens:";
+            for (auto i = tokens.begin(); i != tokens.end(); ++i) {
+                emit << ' ';
+                (*i)->print(emit);
+            }
+            emit << '\n';
+        }
+
+        auto it = std::begin(tokens);
+        parseAndPrint(it, options, llvmContext, std::cerr, emit);
+    }
+
+    if (options.memoryProfile)
+        MemoryProfile::print(std::cerr, sourceBytes);
+
+    emit.flush();
+    if (!emit) {
+        std::cerr << "Cannot write the emitted output" << std::endl;
+        return 1;
+    }
     return 0;
 }
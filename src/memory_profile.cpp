@@ -0,0 +1,151 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include "memory_profile.hpp"
+
+namespace {
+
+    using namespace kaleidoscope;
+
+    const size_t kPhaseCount = static_cast<size_t>(Phase::Execute) + 1;
+
+    const char* const kPhaseNames[kPhaseCount] = { "other", "lex", "parse", "codegen", "compile", "execute" };
+
+    // Plain globals with constant initialization, so that they are usable
+    // by allocations made before main().
+    std::atomic<bool> gEnabled(false);
+    std::atomic<uint64_t> gAllocations[kPhaseCount];
+    std::atomic<uint64_t> gBytes[kPhaseCount];
+    std::atomic<uint64_t> gPeakBytes[kPhaseCount];
+    std::atomic<int64_t> gLiveBytes(0);
+    std::atomic<int64_t> gPeakLiveBytes(0);
+
+    thread_local Phase tCurrentPhase = Phase::Other;
+
+    void updateMax(std::atomic<int64_t>& maximum, int64_t value)
+    {
+        int64_t current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    void updateMax(std::atomic<uint64_t>& maximum, uint64_t value)
+    {
+        uint64_t current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+    }
+
+    void* allocate(size_t size)
+    {
+        void* p = std::malloc(size == 0 ? 1 : size);
+        if (!p)
+            throw std::bad_alloc();
+
+        if (gEnabled.load(std::memory_order_relaxed)) {
+            // the usable size is what delete can see, so live bytes stay balanced
+            const size_t usable = malloc_usable_size(p);
+            const size_t phase = static_cast<size_t>(tCurrentPhase);
+            gAllocations[phase].fetch_add(1, std::memory_order_relaxed);
+            gBytes[phase].fetch_add(usable, std::memory_order_relaxed);
+            const int64_t live = gLiveBytes.fetch_add(usable, std::memory_order_relaxed) + usable;
+            updateMax(gPeakLiveBytes, live);
+            updateMax(gPeakBytes[phase], static_cast<uint64_t>(live));
+        }
+        return p;
+    }
+
+    void deallocate(void* p)
+    {
+        if (p && gEnabled.load(std::memory_order_relaxed))
+            gLiveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+        std::free(p);
+    }
+
+}   // anonymous namespace
+
+
+void* operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    deallocate(p);
+}
+
+
+namespace kaleidoscope {
+
+    void MemoryProfile::enable() noexcept
+    {
+        gEnabled.store(true, std::memory_order_relaxed);
+    }
+
+    MemoryProfile::Counters MemoryProfile::counters(Phase phase) noexcept
+    {
+        const size_t i = static_cast<size_t>(phase);
+        return Counters { gAllocations[i].load(), gBytes[i].load(), gPeakBytes[i].load() };
+    }
+
+    int64_t MemoryProfile::liveBytes() noexcept
+    {
+        return gLiveBytes.load();
+    }
+
+    void MemoryProfile::print(std::ostream& out, size_t sourceBytes)
+    {
+        out << "Memory profile:\n";
+        for (size_t i = 0; i < kPhaseCount; ++i) {
+            const Counters c = counters(static_cast<Phase>(i));
+            out << "  " << kPhaseNames[i] << ": " << c.allocations << " allocations, "
+                << c.bytes << " bytes, heap peaked at " << c.peakBytes << " bytes\n";
+        }
+
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        const uint64_t peakRss = static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+        const int64_t peakHeap = gPeakLiveBytes.load();
+        out << "  peak heap: " << peakHeap << " bytes, peak RSS: " << peakRss << " bytes";
+        if (sourceBytes != 0) {
+            out << "; per source byte: " << static_cast<double>(peakHeap) / sourceBytes << " heap, "
+                << static_cast<double>(peakRss) / sourceBytes << " RSS";
+        }
+        out << std::endl;
+    }
+
+    PhaseScope::PhaseScope(Phase phase) noexcept:
+        previous_(tCurrentPhase)
+    {
+        tCurrentPhase = phase;
+    }
+
+    PhaseScope::~PhaseScope()
+    {
+        tCurrentPhase = previous_;
+    }
+
+}   // namespace kaleidoscope
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+namespace kaleidoscope {
+
+    // Parts of the pipeline which allocations are charged to.
+    enum class Phase {
+        Other,
+        // tokenize(): tokens and their positions
+        Lex,
+        // the parser: AST nodes
+        Parse,
+        // IR generation into the modules of Context
+        Codegen,
+        // optimization and machine code generation by the JIT
+        Compile,
+        // running compiled code
+        Execute,
+    };
+
+    // Counts heap allocations made through operator new, per phase.
+    //
+    // Allocations are charged to the phase of the thread making them (see PhaseScope).
+    // Counting is off until enable() is called; while it is off, the hooks cost
+    // one relaxed load. Memory LLVM takes with malloc directly is not counted,
+    // but shows in the peak RSS.
+    class MemoryProfile {
+    public:
+        struct Counters {
+            uint64_t allocations;
+            // usable size of the allocations, as malloc rounds it up
+            uint64_t bytes;
+            // live heap bytes of the whole process after the largest allocation of the phase
+            uint64_t peakBytes;
+        };
+
+        static void enable() noexcept;
+
+        static Counters counters(Phase phase) noexcept;
+
+        // Bytes allocated since enable() minus bytes freed since, including
+        // frees of memory allocated before it.
+        static int64_t liveBytes() noexcept;
+
+        // Write the allocations and bytes of each phase, the peak heap and RSS,
+        // and both of them per byte of the `sourceBytes` long input.
+        static void print(std::ostream& out, size_t sourceBytes);
+    };
+
+    // Charges the allocations of the current thread to `phase` while it lives.
+    class PhaseScope {
+    public:
+        explicit PhaseScope(Phase phase) noexcept;
+        ~PhaseScope();
+
+        PhaseScope(const PhaseScope&) = delete;
+        PhaseScope& operator=(const PhaseScope&) = delete;
+
+    private:
+        Phase previous_;
+    };
+
+}   // namespace kaleidoscope
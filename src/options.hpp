@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace kaleidoscope {
+
+    // How strictly floating-point arithmetic follows IEEE 754 semantics.
+    enum class FloatingPointMode {
+        // Every operation is rounded separately; no contraction or reassociation.
+        Strict,
+        // `a * b + c` may be fused into a single FMA instruction.
+        Contract,
+        // Reassociation, reciprocal approximation and contraction are all allowed.
+        Fast,
+    };
+
+    // Library providing SIMD versions of math functions for the vectorizer.
+    enum class VectorLibrary {
+        None,
+        // glibc's libmvec
+        Libmvec,
+        // SLEEF, for systems without libmvec
+        Sleef,
+    };
+
+    // What is written to the emit stream while the input is processed.
+    enum class EmitMode {
+        // The tokens, then the IR of each function as it is read.
+        Trace,
+        // Nothing; only results and diagnostics are printed.
+        None,
+        // The tokens.
+        Tokens,
+        // The syntax tree of each item.
+        Ast,
+        // Every function compiled in the session, as one module in textual IR,
+        // bitcode or a relocatable object file. Written when the input ends.
+        LlvmIr,
+        Bitcode,
+        Object,
+    };
+
+    // Options that control code generation and execution.
+    struct Options {
+        FloatingPointMode fpMode = FloatingPointMode::Strict;
+
+        // Generate code for the CPU of the host instead of a generic one.
+        bool tuneForHost = false;
+
+        VectorLibrary vectorLibrary = VectorLibrary::Libmvec;
+
+        // Instrument generated code to count calls and comparisons.
+        bool profile = false;
+
+        // File to write the profile to when the input ends; empty for none.
+        std::string profileOutput;
+
+        // Share identical subexpressions between and within definitions.
+        bool hashCons = false;
+
+        // Number of threads evaluating top-level expressions. Batches containing an
+        // expression which may call an extern other than a math intrinsic run sequentially.
+        unsigned jobs = 1;
+
+        // Number of calls after which a function is recompiled using its profile.
+        uint64_t hotThreshold = 10000;
+
+        // Number of calls with the same constant arguments after which the callee
+        // is specialized for them; 0 disables specialization.
+        unsigned specializeThreshold = 0;
+
+        // Maximum number of expression nodes in all the specialized functions together.
+        size_t specializeBudget = 10000;
+
+        // Ask for transparent huge pages for JIT-compiled code and data.
+        bool jitHugePages = false;
+
+        // Print statistics of the memory for JIT-compiled code when the input ends.
+        bool jitStats = false;
+
+        // Run lexing, parsing, compilation and evaluation concurrently on threads of their own.
+        bool pipeline = false;
+
+        // Count allocations per phase of the pipeline and print them with the peak memory use at the end.
+        bool memoryProfile = false;
+
+        EmitMode emit = EmitMode::Trace;
+
+        // File to write emitted output to; empty for the standard output.
+        std::string emitOutput;
+    };
+
+    // Parse the name of a floating-point mode ("strict", "contract" or "fast").
+    // Returns false if `name` is not a valid mode.
+    inline bool parseFloatingPointMode(const std::string& name, FloatingPointMode* mode)
+    {
+        if (name == "strict") {
+            *mode = FloatingPointMode::Strict;
+        } else if (name == "contract") {
+            *mode = FloatingPointMode::Contract;
+        } else if (name == "fast") {
+            *mode = FloatingPointMode::Fast;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Parse the name of a vector library ("none", "libmvec" or "sleef").
+    // Returns false if `name` is not a valid library.
+    inline bool parseVectorLibrary(const std::string& name, VectorLibrary* library)
+    {
+        if (name == "none") {
+            *library = VectorLibrary::None;
+        } else if (name == "libmvec") {
+            *library = VectorLibrary::Libmvec;
+        } else if (name == "sleef") {
+            *library = VectorLibrary::Sleef;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Parse the name of an emit mode ("trace", "none", "tokens", "ast", "llvm-ir",
+    // "bitcode" or "obj"). Returns false if `name` is not a valid mode.
+    inline bool parseEmitMode(const std::string& name, EmitMode* mode)
+    {
+        if (name == "trace") {
+            *mode = EmitMode::Trace;
+        } else if (name == "none") {
+            *mode = EmitMode::None;
+        } else if (name == "tokens") {
+            *mode = EmitMode::Tokens;
+        } else if (name == "ast") {
+            *mode = EmitMode::Ast;
+        } else if (name == "llvm-ir") {
+            *mode = EmitMode::LlvmIr;
+        } else if (name == "bitcode") {
+            *mode = EmitMode::Bitcode;
+        } else if (name == "obj") {
+            *mode = EmitMode::Object;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+}   // namespace kaleidoscope
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <cstdio>
 #include <string>
 
 
@@ -21,11 +20,9 @@ public:
         return column_;
     }
 
+    // "name:line:column"
     std::string toString() const {
-        const size_t len = name_.size() + 1 + 20 + 1 + 20 + 1;
-        std::string result(len, '\0');
-        std::snprintf(&result[0], len, "%s:%zd:%zd", name_.c_str(), line_, column_);
-        return std::move(result);
+        return name_ + ':' + std::to_string(line_) + ':' + std::to_string(column_);
     }
 
 private:
@@ -0,0 +1,40 @@
+#include <tuple>
+#include <utility>
+
+#include "profile.hpp"
+
+namespace kaleidoscope {
+
+    uint64_t Profile::count(const std::string& key) const
+    {
+        const auto it = counters_.find(key);
+        return it == counters_.end() ? 0 : it->second.load(std::memory_order_relaxed);
+    }
+
+    void Profile::emitIncrement(llvm::IRBuilder<>& builder, const std::string& key, llvm::Value* amount)
+    {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "counters must be plain i64 in memory");
+        std::atomic<uint64_t>* counter =
+            &counters_.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(0))
+                .first->second;
+
+        // The compile thread reads the counters while code runs on others, so
+        // updates are atomic; monotonic (relaxed) order is enough for counting.
+        llvm::IntegerType* int64Type = builder.getInt64Ty();
+        llvm::Constant* address = llvm::ConstantExpr::getIntToPtr(
+                builder.getInt64(reinterpret_cast<uintptr_t>(counter)), int64Type->getPointerTo());
+        builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, address, amount, llvm::AtomicOrdering::Monotonic);
+    }
+
+    void Profile::emitIncrement(llvm::IRBuilder<>& builder, const std::string& key)
+    {
+        emitIncrement(builder, key, builder.getInt64(1));
+    }
+
+    void Profile::dump(std::ostream& out) const
+    {
+        for (const auto& counter : counters_)
+            out << counter.first << " " << counter.second.load(std::memory_order_relaxed) << "\n";
+    }
+
+}   // namespace kaleidoscope
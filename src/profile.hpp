@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+#include <llvm/IR/IRBuilder.h>
+
+namespace kaleidoscope {
+
+    // Counters updated by instrumented code at run time.
+    //
+    // Instrumented code may run on other threads than the one compiling it
+    // (see --jobs and --pipeline), so counters are updated and read atomically.
+    //
+    // Each counter is identified by a key of the form
+    //   "entry <function>"               calls of a function
+    //   "call <position> <callee>"       executions of a call site
+    //   "compare <position> total|true"  evaluations (and true results) of '<'
+    class Profile {
+    public:
+        Profile(): counters_() {}
+
+        Profile(const Profile&) = delete;
+        Profile& operator=(const Profile&) = delete;
+
+        // Returns the current value of the counter `key`, or 0 if it does not exist.
+        uint64_t count(const std::string& key) const;
+
+        // Emit code which adds `amount` (an i64) to the counter `key`.
+        // The counter is created if it does not exist.
+        void emitIncrement(llvm::IRBuilder<>& builder, const std::string& key, llvm::Value* amount);
+
+        // Emit code which adds one to the counter `key`.
+        void emitIncrement(llvm::IRBuilder<>& builder, const std::string& key);
+
+        // Write every counter as a "<key> <count>" line.
+        void dump(std::ostream& out) const;
+
+    private:
+        // Instrumented code refers to the counters by address;
+        // nodes of std::map are never moved.
+        std::map<std::string, std::atomic<uint64_t>> counters_;
+    };
+
+}   // namespace kaleidoscope
@@ -0,0 +1,198 @@
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <llvm/IR/LLVMContext.h>
+
+#include "ast.hpp"
+#include "server.hpp"
+#include "token.hpp"
+
+namespace {
+
+    using namespace kaleidoscope;
+
+    // A client must send its whole program within this time and in at most this
+    // many bytes, so that idle or slow clients cannot hold every session.
+    const std::chrono::milliseconds kRequestTimeout(10000);
+    const size_t kMaxRequestSize = 16 * 1024 * 1024;
+
+    // Read until the client shuts down its sending side.
+    // Returns false with a message in `error` if it is too slow or sends too much.
+    bool readRequest(int fd, std::string* data, std::string* error)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point deadline = Clock::now() + kRequestTimeout;
+        char buffer[64 * 1024];
+        for (;;) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            pollfd request = { fd, POLLIN, 0 };
+            const int ready = remaining.count() > 0 ? ::poll(&request, 1, remaining.count()) : 0;
+            if (ready < 0 && errno == EINTR)
+                continue;
+            if (ready == 0) {
+                *error = "timed out reading the program";
+                return false;
+            }
+
+            const ssize_t n = ready < 0 ? -1 : ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return true;
+            if (data->size() + n > kMaxRequestSize) {
+                *error = "program too large";
+                return false;
+            }
+            data->append(buffer, n);
+        }
+    }
+
+    void writeAll(int fd, const std::string& data)
+    {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            written += n;
+        }
+    }
+
+    // Counts the sessions being served and blocks new ones beyond a limit.
+    class SessionLimit {
+    public:
+        explicit SessionLimit(unsigned maxSessions): mutex_(), changed_(), active_(0), max_(maxSessions) {}
+
+        // Wait until fewer than the maximum number of sessions are active, and count one more.
+        void acquire() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] { return active_ < max_; });
+            ++active_;
+        }
+
+        void release() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_;
+            changed_.notify_all();
+        }
+
+        // Wait until every session has ended.
+        void waitForAll() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this] { return active_ == 0; });
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        unsigned active_;
+        const unsigned max_;
+    };
+
+    void serveConnection(int fd, const Options& options, SessionLimit& limit)
+    {
+        // nor may a client which does not read the reply hold a session
+        const timeval sendTimeout = { kRequestTimeout.count() / 1000, 0 };
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+        std::string source;
+        std::string error;
+        std::ostringstream out;
+
+        if (!readRequest(fd, &source, &error)) {
+            out << "error: " << error << std::endl;
+        } else {
+            try {
+                std::istringstream stream(source);
+                std::string filename = "client";
+                auto tokens = tokenize(std::istreambuf_iterator<char>(stream),
+                                       std::istreambuf_iterator<char>(), filename);
+                auto it = std::begin(tokens);
+
+                llvm::LLVMContext llvmContext;
+                parseAndPrint(it, options, llvmContext, out, out);
+            } catch (const TokenizationError& e) {
+                out << e.what() << std::endl;
+            } catch (const std::exception& e) {
+                // the thread is detached, so an escaping exception would terminate the server
+                out << "error: " << e.what() << std::endl;
+            }
+        }
+
+        writeAll(fd, out.str());
+        ::close(fd);
+        limit.release();
+    }
+
+}   // anonymous namespace
+
+
+namespace kaleidoscope {
+
+    bool runServer(const std::string& path, const Options& options, unsigned maxSessions)
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::fprintf(stderr, "socket path too long: %s\n", path.c_str());
+            return false;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+
+        const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) {
+            std::perror("socket");
+            return false;
+        }
+
+        ::unlink(path.c_str());
+        if (::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+                ::listen(listener, SOMAXCONN) < 0) {
+            std::perror(path.c_str());
+            ::close(listener);
+            return false;
+        }
+
+        // a client closing early must not kill the server
+        ::signal(SIGPIPE, SIG_IGN);
+
+        // Clients beyond the limit wait in the backlog of the listener until a session ends.
+        SessionLimit limit(maxSessions);
+        for (;;) {
+            limit.acquire();
+            int fd;
+            do {
+                fd = ::accept(listener, nullptr, nullptr);
+            } while (fd < 0 && (errno == EINTR || errno == ECONNABORTED));
+            if (fd < 0) {
+                std::perror("accept");
+                limit.release();
+                break;
+            }
+            std::thread(serveConnection, fd, std::cref(options), std::ref(limit)).detach();
+        }
+
+        ::close(listener);
+        limit.waitForAll();
+        return false;
+    }
+
+}   // namespace kaleidoscope
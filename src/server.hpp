@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "options.hpp"
+
+namespace kaleidoscope {
+
+    // Serve programs sent over the Unix domain socket at `path` until the process is killed.
+    //
+    // Every connection is a separate session with its own LLVMContext, module and JIT,
+    // served on its own thread; at most `maxSessions` are served at once, and further
+    // clients wait until one ends. The client sends a program and shuts down its sending
+    // side within 10 seconds and 16 MiB; the server replies with everything parseAndPrint
+    // prints and closes the connection. LLVM targets must be initialized before calling
+    // this function; the host CPU and the vector library are looked up by the first session.
+    //
+    // Errors in a program, including calls to functions which cannot be linked, are
+    // reported to its client. Sessions share the process, though, so JIT'd code which
+    // crashes (e.g. by unbounded recursion) takes every session down with the server.
+    // Run it under a supervisor which restarts it if that matters.
+    //
+    // Returns false if the socket cannot be set up.
+    bool runServer(const std::string& path, const Options& options, unsigned maxSessions);
+
+}   // namespace kaleidoscope
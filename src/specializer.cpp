@@ -0,0 +1,184 @@
+#include "specializer.hpp"
+
+namespace {
+
+    using namespace kaleidoscope;
+
+    size_t countNodes(const ExprNode& node)
+    {
+        if (auto n = dynamic_cast<const BinaryExprNode*>(&node))
+            return 1 + countNodes(*n->lhs()) + countNodes(*n->rhs());
+
+        if (auto n = dynamic_cast<const CallExprNode*>(&node)) {
+            size_t count = 1;
+            for (size_t i = 0; i < n->argumentCount(); ++i)
+                count += countNodes(*n->argument(i));
+            return count;
+        }
+
+        if (auto n = dynamic_cast<const ReductionExprNode*>(&node))
+            return 1 + countNodes(*n->start()) + countNodes(*n->end()) + countNodes(*n->body());
+
+        return 1;
+    }
+
+    // Returns a copy of `node` in which the variables in `constants` are replaced
+    // by their values and operators whose operands became numbers are folded.
+    std::shared_ptr<const ExprNode> substitute(const ExprNode& node, const std::map<std::string, double>& constants)
+    {
+        if (auto n = dynamic_cast<const NumberExprNode*>(&node))
+            return std::make_shared<NumberExprNode>(n->position(), n->value());
+
+        if (auto n = dynamic_cast<const VariableExprNode*>(&node)) {
+            const auto it = constants.find(n->name());
+            if (it != constants.end())
+                return std::make_shared<NumberExprNode>(n->position(), it->second);
+            return std::make_shared<VariableExprNode>(n->position(), n->name());
+        }
+
+        if (auto n = dynamic_cast<const BinaryExprNode*>(&node)) {
+            auto lhs = substitute(*n->lhs(), constants);
+            auto rhs = substitute(*n->rhs(), constants);
+            auto l = dynamic_cast<const NumberExprNode*>(lhs.get());
+            auto r = dynamic_cast<const NumberExprNode*>(rhs.get());
+            if (l && r) {
+                switch (n->op()) {
+                case '+': return std::make_shared<NumberExprNode>(n->position(), l->value() + r->value());
+                case '-': return std::make_shared<NumberExprNode>(n->position(), l->value() - r->value());
+                case '*': return std::make_shared<NumberExprNode>(n->position(), l->value() * r->value());
+                // unordered like the FCmpULT of codegen, so NaN compares true
+                case '<': return std::make_shared<NumberExprNode>(n->position(), !(l->value() >= r->value()) ? 1.0 : 0.0);
+                }
+            }
+            return std::make_shared<BinaryExprNode>(n->position(), n->op(), lhs, rhs);
+        }
+
+        if (auto n = dynamic_cast<const CallExprNode*>(&node)) {
+            std::vector<std::shared_ptr<const ExprNode>> args;
+            for (size_t i = 0; i < n->argumentCount(); ++i)
+                args.push_back(substitute(*n->argument(i), constants));
+            return std::make_shared<CallExprNode>(n->position(), n->callee(), std::move(args));
+        }
+
+        if (auto n = dynamic_cast<const ReductionExprNode*>(&node)) {
+            // the index variable shadows a parameter of the same name
+            std::map<std::string, double> inner(constants);
+            inner.erase(n->variable());
+            return std::make_shared<ReductionExprNode>(
+                    n->position(), n->kind(), n->variable(),
+                    substitute(*n->start(), constants), substitute(*n->end(), constants),
+                    substitute(*n->body(), inner));
+        }
+
+        throw CodegenError(node.position(), "unknown kind of expression");
+    }
+
+}   // anonymous namespace
+
+
+namespace kaleidoscope {
+
+    std::shared_ptr<const ExprNode> Specializer::rewrite(const std::string& name, const ExprNode& body)
+    {
+        // Clones of the old definition, and clones of other functions calling it,
+        // must not be used any more. Budget already spent is not given back,
+        // since their code stays compiled.
+        if (definitions_.count(name)) {
+            counts_.clear();
+            specializations_.clear();
+        }
+        return rewriteExpr(body, name);
+    }
+
+    std::vector<std::unique_ptr<FunctionNode>> Specializer::takeNewFunctions()
+    {
+        std::vector<std::unique_ptr<FunctionNode>> functions;
+        functions.swap(newFunctions_);
+        return functions;
+    }
+
+    std::shared_ptr<const ExprNode> Specializer::rewriteExpr(const ExprNode& node, const std::string& excluded)
+    {
+        if (auto n = dynamic_cast<const BinaryExprNode*>(&node)) {
+            return std::make_shared<BinaryExprNode>(
+                    n->position(), n->op(), rewriteExpr(*n->lhs(), excluded), rewriteExpr(*n->rhs(), excluded));
+        }
+
+        if (auto n = dynamic_cast<const ReductionExprNode*>(&node)) {
+            return std::make_shared<ReductionExprNode>(
+                    n->position(), n->kind(), n->variable(), rewriteExpr(*n->start(), excluded),
+                    rewriteExpr(*n->end(), excluded), rewriteExpr(*n->body(), excluded));
+        }
+
+        auto call = dynamic_cast<const CallExprNode*>(&node);
+        if (!call)
+            return substitute(node, std::map<std::string, double>());
+
+        std::vector<std::shared_ptr<const ExprNode>> args;
+        Pattern pattern(call->callee(), std::vector<std::pair<bool, double>>());
+        bool hasConstant = false;
+        for (size_t i = 0; i < call->argumentCount(); ++i) {
+            args.push_back(rewriteExpr(*call->argument(i), excluded));
+            auto number = dynamic_cast<const NumberExprNode*>(args.back().get());
+            pattern.second.emplace_back(number != nullptr, number ? number->value() : 0.0);
+            hasConstant = hasConstant || number;
+        }
+
+        const auto definition = definitions_.find(call->callee());
+        if (!hasConstant || call->callee() == excluded || definition == definitions_.end() ||
+                definition->second->prototype()->argumentCount() != args.size())
+            return std::make_shared<CallExprNode>(call->position(), call->callee(), std::move(args));
+
+        const std::string* name = specialize(pattern, *definition->second, excluded);
+        if (!name)
+            return std::make_shared<CallExprNode>(call->position(), call->callee(), std::move(args));
+
+        std::vector<std::shared_ptr<const ExprNode>> remainingArgs;
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (!pattern.second[i].first)
+                remainingArgs.push_back(std::move(args[i]));
+        }
+        return std::make_shared<CallExprNode>(call->position(), *name, std::move(remainingArgs));
+    }
+
+    // Returns the name of the specialization for `pattern`, creating it if the pattern
+    // has become frequent enough, or nullptr if the generic function should be called.
+    const std::string* Specializer::specialize(const Pattern& pattern, const FunctionNode& callee,
+                                               const std::string& excluded)
+    {
+        const auto existing = specializations_.find(pattern);
+        if (existing != specializations_.end())
+            return &existing->second;
+
+        if (++counts_[pattern] < threshold_)
+            return nullptr;
+
+        const PrototypeNode* proto = callee.prototype();
+        std::map<std::string, double> constants;
+        std::vector<std::string> params;
+        for (size_t i = 0; i < pattern.second.size(); ++i) {
+            if (pattern.second[i].first)
+                constants[proto->argument(i)] = pattern.second[i].second;
+            else
+                params.push_back(proto->argument(i));
+        }
+
+        auto body = substitute(*callee.body(), constants);
+        const size_t size = countNodes(*body);
+        if (used_ + size > budget_)
+            return nullptr;
+        used_ += size;
+
+        // Register the name before rewriting the body, so that a recursive call
+        // with the same pattern refers to the clone itself.
+        const std::string name = proto->name() + ".spec" + std::to_string(created_++);
+        const std::string& registered = specializations_[pattern] = name;
+
+        body = rewriteExpr(*body, excluded);
+        newFunctions_.emplace_back(new FunctionNode(
+                std::unique_ptr<PrototypeNode>(new PrototypeNode(proto->position(), name, params)),
+                std::move(body)));
+        return &registered;
+    }
+
+}   // namespace kaleidoscope
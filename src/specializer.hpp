@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ast.hpp"
+
+namespace kaleidoscope {
+
+    // Specializes definitions for constant arguments.
+    //
+    // rewrite() counts, for every call to a known definition, which arguments
+    // are number literals and what their values are. Once the same pattern has
+    // been seen `threshold` times, the callee is cloned with those parameters
+    // replaced by the constants and the clone is partially evaluated; that call
+    // and later ones with the pattern then call the clone with the remaining
+    // arguments. The AST nodes of all clones together never exceed `budget`.
+    class Specializer {
+    public:
+        Specializer(const std::map<std::string, std::unique_ptr<FunctionNode>>& definitions,
+                    unsigned threshold, size_t budget):
+            definitions_(definitions), threshold_(threshold), budget_(budget),
+            used_(0), created_(0), counts_(), specializations_(), newFunctions_() {}
+
+        Specializer(const Specializer&) = delete;
+        Specializer& operator=(const Specializer&) = delete;
+
+        // Returns a copy of `body`, the body of the function `name`, with its calls
+        // rewritten to use specializations. Calls to `name` itself are left alone.
+        // If `name` is already defined, it is being redefined and every
+        // specialization made so far is dropped first.
+        std::shared_ptr<const ExprNode> rewrite(const std::string& name, const ExprNode& body);
+
+        // Returns the clones created since the last call. They must be compiled
+        // before the functions which call them.
+        std::vector<std::unique_ptr<FunctionNode>> takeNewFunctions();
+
+    private:
+        // Callee and, for each argument, whether it is a constant and its value.
+        typedef std::pair<std::string, std::vector<std::pair<bool, double>>> Pattern;
+
+        std::shared_ptr<const ExprNode> rewriteExpr(const ExprNode& node, const std::string& excluded);
+        const std::string* specialize(const Pattern& pattern, const FunctionNode& callee,
+                                      const std::string& excluded);
+
+        const std::map<std::string, std::unique_ptr<FunctionNode>>& definitions_;
+        const unsigned threshold_;
+        const size_t budget_;
+        size_t used_;
+        size_t created_;
+        std::map<Pattern, unsigned> counts_;
+        std::map<Pattern, std::string> specializations_;
+        std::vector<std::unique_ptr<FunctionNode>> newFunctions_;
+    };
+
+}   // namespace kaleidoscope
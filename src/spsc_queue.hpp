@@ -0,0 +1,166 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace kaleidoscope {
+
+    // Lets threads which have run out of work block until another thread makes
+    // progress. Ringing costs an atomic increment and load while nobody is blocked.
+    class Doorbell {
+    public:
+        Doorbell(): epoch_(0), sleepers_(0), mutex_(), rung_() {}
+
+        Doorbell(const Doorbell&) = delete;
+        Doorbell& operator=(const Doorbell&) = delete;
+
+        // Read this before looking for work, and pass it to sleep() if there is none.
+        uint64_t epoch() const {
+            return epoch_.load();
+        }
+
+        void ring() {
+            epoch_.fetch_add(1);
+            // Pairs with sleep(): either the sleeper sees the new epoch or this sees the sleeper.
+            if (sleepers_.load() != 0) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                rung_.notify_all();
+            }
+        }
+
+        // Blocks until ring() has been called since `epoch` was read.
+        void sleep(uint64_t epoch) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            sleepers_.fetch_add(1);
+            rung_.wait(lock, [&] { return epoch_.load() != epoch; });
+            sleepers_.fetch_sub(1);
+        }
+
+    private:
+        std::atomic<uint64_t> epoch_;
+        std::atomic<unsigned> sleepers_;
+        std::mutex mutex_;
+        std::condition_variable rung_;
+    };
+
+
+    // Waits for another thread to make progress: spins first, then yields the CPU,
+    // then blocks on `doorbell` until it rings, so that a stage waiting on slow input
+    // neither burns a core nor oversleeps. Without a doorbell it sleeps 100us at a time.
+    // Call wait() each time a check for work comes up empty.
+    class Backoff {
+    public:
+        explicit Backoff(Doorbell* doorbell = nullptr):
+            doorbell_(doorbell), epoch_(doorbell ? doorbell->epoch() : 0), rounds_(0) {}
+
+        void wait() {
+            if (rounds_ < kSpinRounds) {
+                ++rounds_;
+            } else if (rounds_ < kYieldRounds) {
+                ++rounds_;
+                std::this_thread::yield();
+            } else if (doorbell_) {
+                doorbell_->sleep(epoch_);
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            // for the next check, which happens after this returns
+            if (doorbell_)
+                epoch_ = doorbell_->epoch();
+        }
+
+    private:
+        static const unsigned kSpinRounds = 64;
+        static const unsigned kYieldRounds = 256;
+
+        Doorbell* const doorbell_;
+        uint64_t epoch_;
+        unsigned rounds_;
+    };
+
+
+    // A bounded queue from one producer thread to one consumer thread.
+    //
+    // The elements live in a ring buffer. The producer only writes `tail_` and the
+    // consumer only writes `head_`, so neither push nor pop takes a lock, and the
+    // two indices sit on separate cache lines to keep the threads from sharing one.
+    // If the queue has a doorbell, every push and pop rings it; several queues may
+    // share one, so that a thread waiting on any of them can block on it.
+    template <typename T>
+    class SpscQueue {
+    public:
+        // `capacity` is rounded up to a power of two.
+        explicit SpscQueue(size_t capacity, Doorbell* doorbell = nullptr):
+            slots_(roundUpToPowerOfTwo(capacity)), mask_(slots_.size() - 1), doorbell_(doorbell),
+            head_(0), tail_(0) {}
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // Called by the producer. Returns false, leaving `value` alone, if the queue is full.
+        bool tryPush(T&& value) {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail - head_.load(std::memory_order_acquire) == slots_.size())
+                return false;
+            slots_[tail & mask_] = std::move(value);
+            tail_.store(tail + 1, std::memory_order_release);
+            if (doorbell_)
+                doorbell_->ring();
+            return true;
+        }
+
+        // Called by the producer. Waits while the queue is full.
+        void push(T&& value) {
+            Backoff backoff(doorbell_);
+            while (!tryPush(std::move(value)))
+                backoff.wait();
+        }
+
+        // Called by the consumer. Returns false if the queue is empty.
+        bool tryPop(T* value) {
+            const size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_.load(std::memory_order_acquire))
+                return false;
+            *value = std::move(slots_[head & mask_]);
+            slots_[head & mask_] = T();
+            head_.store(head + 1, std::memory_order_release);
+            if (doorbell_)
+                doorbell_->ring();
+            return true;
+        }
+
+        // Called by the consumer. Waits while the queue is empty.
+        void pop(T* value) {
+            Backoff backoff(doorbell_);
+            while (!tryPop(value))
+                backoff.wait();
+        }
+
+        // Returns the doorbell given to the constructor, or null.
+        Doorbell* doorbell() const {
+            return doorbell_;
+        }
+
+    private:
+        static size_t roundUpToPowerOfTwo(size_t n) {
+            size_t p = 1;
+            while (p < n)
+                p *= 2;
+            return p;
+        }
+
+        std::vector<T> slots_;
+        const size_t mask_;
+        Doorbell* const doorbell_;
+        alignas(64) std::atomic<size_t> head_;
+        alignas(64) std::atomic<size_t> tail_;
+    };
+
+}   // namespace kaleidoscope
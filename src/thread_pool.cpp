@@ -0,0 +1,107 @@
+#include "thread_pool.hpp"
+
+namespace kaleidoscope {
+
+    ThreadPool::ThreadPool(size_t threadCount):
+        workers_(), threads_(), mutex_(), wakeUp_(), done_(),
+        job_(nullptr), remaining_(0), active_(0), generation_(0), stopping_(false)
+    {
+        for (size_t i = 0; i < threadCount; ++i)
+            workers_.emplace_back(new Worker());
+        for (size_t i = 0; i < threadCount; ++i)
+            threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wakeUp_.notify_all();
+        for (auto& thread : threads_)
+            thread.join();
+    }
+
+    void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& f)
+    {
+        if (count == 0)
+            return;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        // a worker late for the previous loop must not take tasks of this one
+        done_.wait(lock, [this] { return active_ == 0; });
+
+        // Give each worker a contiguous block; stealing evens out the rest.
+        const size_t n = workers_.size();
+        for (size_t i = 0; i < n; ++i) {
+            std::lock_guard<std::mutex> workerLock(workers_[i]->mutex);
+            for (size_t task = count * i / n; task < count * (i + 1) / n; ++task)
+                workers_[i]->tasks.push_back(task);
+        }
+
+        job_ = &f;
+        remaining_ = count;
+        ++generation_;
+        wakeUp_.notify_all();
+
+        done_.wait(lock, [this] { return remaining_ == 0 && active_ == 0; });
+        job_ = nullptr;
+    }
+
+    void ThreadPool::workerLoop(size_t self)
+    {
+        uint64_t seenGeneration = 0;
+        for (;;) {
+            const std::function<void(size_t)>* job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wakeUp_.wait(lock, [&] { return stopping_ || generation_ != seenGeneration; });
+                if (stopping_)
+                    return;
+                seenGeneration = generation_;
+                job = job_;
+                if (!job)
+                    continue;
+                ++active_;
+            }
+
+            size_t task;
+            while (popTask(self, &task)) {
+                (*job)(task);
+                --remaining_;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--active_ == 0)
+                done_.notify_all();
+        }
+    }
+
+    bool ThreadPool::popTask(size_t self, size_t* task)
+    {
+        {
+            Worker& own = *workers_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                *task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                *task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+}   // namespace kaleidoscope
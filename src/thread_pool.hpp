@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kaleidoscope {
+
+    // A fixed set of threads which run loops in parallel.
+    //
+    // Each worker has its own deque of task indices. A worker pops tasks from the
+    // front of its own deque and, once it runs dry, steals from the back of the
+    // others', so uneven tasks are balanced without a shared queue.
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threadCount);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Call f(0), ..., f(count - 1) on the workers and wait until all of them return.
+        // `f` must not throw.
+        void parallelFor(size_t count, const std::function<void(size_t)>& f);
+
+    private:
+        struct Worker {
+            Worker(): mutex(), tasks() {}
+
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        void workerLoop(size_t self);
+        bool popTask(size_t self, size_t* task);
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::vector<std::thread> threads_;
+
+        std::mutex mutex_;
+        std::condition_variable wakeUp_;
+        std::condition_variable done_;
+        const std::function<void(size_t)>* job_;
+        std::atomic<size_t> remaining_;
+        size_t active_;             // workers running `job_`
+        uint64_t generation_;
+        bool stopping_;
+    };
+
+}   // namespace kaleidoscope
@@ -1,27 +1,11 @@
 #include <cctype>
 #include <cstdio>
+#include "memory_profile.hpp"
 #include "token.hpp"
 
 namespace {
 
-    inline int readChar(
-            std::istreambuf_iterator<char>* pFirst,
-            std::istreambuf_iterator<char>* pLast,
-            size_t* pLine,
-            size_t* pColumn)
-    {
-        if (*pFirst == *pLast)
-            return EOF;
-        const int ch = **pFirst;
-        if (ch == '\n') {
-            *pLine += 1;
-            *pColumn = 1;
-        } else {
-            *pColumn += 1;
-        }
-        ++*pFirst;
-        return ch;
-    }
+    const int kUnread = EOF - 1;
 
 }   // anonymous namespace
 
@@ -32,90 +16,154 @@ namespace kaleidoscope {
         return "eof";
     }
 
+    void EofToken::print(std::ostream& out) const
+    {
+        out << "eof";
+    }
+
     std::string DefToken::toString() const
     {
         return "def";
     }
 
+    void DefToken::print(std::ostream& out) const
+    {
+        out << "def";
+    }
+
     std::string ExternToken::toString() const
     {
         return "extern";
     }
 
+    void ExternToken::print(std::ostream& out) const
+    {
+        out << "extern";
+    }
+
     std::string IdentifierToken::toString() const
     {
         return "identifier('" + name_ + "')";
     }
 
+    void IdentifierToken::print(std::ostream& out) const
+    {
+        out << "identifier('" << name_ << "')";
+    }
+
     std::string NumberToken::toString() const
     {
         return "number(" + std::to_string(number_) + ")";
     }
 
+    void NumberToken::print(std::ostream& out) const
+    {
+        // same format as std::to_string(double)
+        char buffer[512];
+        std::snprintf(buffer, sizeof(buffer), "%f", number_);
+        out << "number(" << buffer << ")";
+    }
+
     std::string CharToken::toString() const
     {
         return "char('" + std::string(1, ch_) + "')";
     }
 
-    std::vector<std::unique_ptr<Token>> tokenize(
-            std::istreambuf_iterator<char> first,
-            std::istreambuf_iterator<char> last,
-            const std::string& filename)
+    void CharToken::print(std::ostream& out) const
     {
-        if (first == last)
-            throw TokenizationError(Position(filename, 1, 1), "unexpected end of file");
+        out << "char('" << ch_ << "')";
+    }
 
-        size_t line = 1;
-        size_t column = 1;
-        int ch = *first;
-        std::vector<std::unique_ptr<Token>> tokens;
-        ++first;
+    Lexer::Lexer(std::istreambuf_iterator<char> first,
+                 std::istreambuf_iterator<char> last,
+                 const std::string& filename):
+        first_(first), last_(last), filename_(filename), line_(1), column_(1), ch_(kUnread), started_(false) {}
+
+    std::unique_ptr<Token> Lexer::next()
+    {
+        const PhaseScope phase(Phase::Lex);
+        if (!started_) {
+            if (first_ == last_)
+                throw TokenizationError(Position(filename_, 1, 1), "unexpected end of file");
+            ch_ = *first_;
+            ++first_;
+            started_ = true;
+        }
+        if (ch_ == kUnread)
+            ch_ = readChar();
 
         for (;;) {
             // skip spaces
-            while (std::isspace(ch)) {
-                ch = readChar(&first, &last, &line, &column);
+            while (std::isspace(ch_)) {
+                ch_ = readChar();
             }
 
-            if (ch == EOF) {
-                break;
-            } else if (std::isalpha(ch) || ch == '_') {
+            if (ch_ == EOF) {
+                return std::unique_ptr<Token>(new EofToken(Position(filename_, line_, column_)));
+            } else if (std::isalpha(ch_) || ch_ == '_') {
                 std::string s;
                 do {
-                    s.push_back(ch);
-                    ch = readChar(&first, &last, &line, &column);
-                } while (std::isalpha(ch) || ch == '_');
-
-                if (s == "def") {
-                    tokens.emplace_back(new DefToken(Position(filename, line, column)));
-                } else if (s == "extern") {
-                    tokens.emplace_back(new ExternToken(Position(filename, line, column)));
-                } else {
-                    tokens.emplace_back(new IdentifierToken(Position(filename, line, column), s));
-                }
-            } else if (std::isdigit(ch) || ch == '.') {
+                    s.push_back(ch_);
+                    ch_ = readChar();
+                } while (std::isalpha(ch_) || ch_ == '_');
+
+                if (s == "def")
+                    return std::unique_ptr<Token>(new DefToken(Position(filename_, line_, column_)));
+                if (s == "extern")
+                    return std::unique_ptr<Token>(new ExternToken(Position(filename_, line_, column_)));
+                return std::unique_ptr<Token>(new IdentifierToken(Position(filename_, line_, column_), s));
+            } else if (std::isdigit(ch_) || ch_ == '.') {
                 std::string s;
                 do {
-                    s.push_back(ch);
-                    ch = readChar(&first, &last, &line, &column);
-                } while (std::isdigit(ch) || ch == '.');
+                    s.push_back(ch_);
+                    ch_ = readChar();
+                } while (std::isdigit(ch_) || ch_ == '.');
 
                 double x;
                 if (std::sscanf(s.c_str(), "%lf", &x) != 1)
-                    throw TokenizationError(Position(filename, line, column), "invalid format of number");
-                tokens.emplace_back(new NumberToken(Position(filename, line, column), x));
-            } else if (ch == '#') {
+                    throw TokenizationError(Position(filename_, line_, column_), "invalid format of number");
+                return std::unique_ptr<Token>(new NumberToken(Position(filename_, line_, column_), x));
+            } else if (ch_ == '#') {
                 do {
-                    ch = readChar(&first, &last, &line, &column);
-                } while (ch != '\n' && ch != EOF);
+                    ch_ = readChar();
+                } while (ch_ != '\n' && ch_ != EOF);
             } else {
-                tokens.emplace_back(new CharToken(Position(filename, line, column), static_cast<char>(ch)));
-                ch = readChar(&first, &last, &line, &column);
+                std::unique_ptr<Token> token(new CharToken(Position(filename_, line_, column_),
+                                                           static_cast<char>(ch_)));
+                // the character after it is read by the next call
+                ch_ = kUnread;
+                return token;
             }
         }
+    }
+
+    int Lexer::readChar()
+    {
+        if (first_ == last_)
+            return EOF;
+        const int ch = *first_;
+        if (ch == '\n') {
+            line_ += 1;
+            column_ = 1;
+        } else {
+            column_ += 1;
+        }
+        ++first_;
+        return ch;
+    }
 
-        tokens.emplace_back(new EofToken(Position(filename, line, column)));
-        return tokens;
+    std::vector<std::unique_ptr<Token>> tokenize(
+            std::istreambuf_iterator<char> first,
+            std::istreambuf_iterator<char> last,
+            const std::string& filename)
+    {
+        Lexer lexer(first, last, filename);
+        std::vector<std::unique_ptr<Token>> tokens;
+        for (;;) {
+            tokens.push_back(lexer.next());
+            if (dynamic_cast<EofToken*>(tokens.back().get()))
+                return tokens;
+        }
     }
 
 }   // namespace kaleidoscope
@@ -2,6 +2,7 @@
 
 #include <cstdio>
 #include <iostream>
+#include <ostream>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -25,6 +26,9 @@ namespace kaleidoscope {
 
         virtual std::string toString() const = 0;
 
+        // Write the same text as toString() to `out` without allocating.
+        virtual void print(std::ostream& out) const = 0;
+
     private:
         Position position_;
     };
@@ -37,6 +41,7 @@ namespace kaleidoscope {
             Token(position) {}
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
     };
 
 
@@ -47,6 +52,7 @@ namespace kaleidoscope {
             Token(position) {}
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
     };
 
 
@@ -57,6 +63,7 @@ namespace kaleidoscope {
             Token(position) {}
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
     };
 
 
@@ -71,6 +78,7 @@ namespace kaleidoscope {
         }
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
 
     private:
         std::string name_;
@@ -88,6 +96,7 @@ namespace kaleidoscope {
         }
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
 
     private:
         double number_;
@@ -105,6 +114,7 @@ namespace kaleidoscope {
         }
 
         virtual std::string toString() const;
+        virtual void print(std::ostream& out) const;
 
     private:
         char ch_;
@@ -135,6 +145,38 @@ namespace kaleidoscope {
     };
 
 
+    // Reads the tokens of the stream specified by [first, last) one at a time.
+    //
+    // Characters are read only as far as needed for the token returned, so a reader
+    // of an interactive stream gets each token as soon as it has been typed.
+    class Lexer {
+    public:
+        // filename is the name of the stream used for Position stored in returned tokens.
+        // Like them, it refers to `filename`, which must outlive the tokens.
+        Lexer(std::istreambuf_iterator<char> first,
+              std::istreambuf_iterator<char> last,
+              const std::string& filename);
+
+        // Returns the next token; an EofToken once the stream has ended.
+        // Throws a TokenizationError when something fails.
+        std::unique_ptr<Token> next();
+
+    private:
+        int readChar();
+
+        std::istreambuf_iterator<char> first_;
+        std::istreambuf_iterator<char> last_;
+        const std::string& filename_;
+        size_t line_;
+        size_t column_;
+
+        // the current character, or kUnread if the last one has been consumed
+        // and the next one has not been read yet
+        int ch_;
+        bool started_;
+    };
+
+
     // Tokenize the given stream specified by [first, last) into a sequence of tokens.
     // filename is the name of the stream used for Position stored in returned tokens.
     // Throws a TokenizationError when something fails.
@@ -1,9 +1,22 @@
+#include <atomic>
+#include <chrono>
+#include <iterator>
 #include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/TargetSelect.h>
 
 #include "ast.hpp"
+#include "context.hpp"
 #include "position.hpp"
 
 using namespace kaleidoscope;
@@ -21,3 +34,228 @@ TEST(ParseTest, OneNumber) {
     ASSERT_NE(nullptr, n);
     EXPECT_EQ(42, n->value());
 }
+
+TEST(ParseTest, ReportsErrorWithoutThrowing) {
+    std::vector<std::unique_ptr<Token>> v;
+    Position p1(gFileName, 1, 1);
+    Position p2(gFileName, 1, 3);
+    v.emplace_back(new NumberToken(p1, 1));
+    v.emplace_back(new CharToken(p1, '+'));
+    v.emplace_back(new CharToken(p2, ')'));
+    v.emplace_back(new EofToken(p2));
+    auto it = v.begin();
+    Diagnostics diagnostics;
+    std::unique_ptr<ExprNode> node = parseExpr(it, diagnostics);
+    EXPECT_EQ(nullptr, node);
+    ASSERT_EQ(1u, diagnostics.size());
+    EXPECT_EQ(3u, diagnostics.position(0).column());
+}
+
+TEST(ParseTest, ThrowsParseError) {
+    std::vector<std::unique_ptr<Token>> v;
+    Position p(gFileName, 1, 1);
+    v.emplace_back(new CharToken(p, ')'));
+    v.emplace_back(new EofToken(p));
+    auto it = v.begin();
+    EXPECT_THROW(parseExpr(it), ParseError);
+}
+
+TEST(ParseTest, Reduction) {
+    std::vector<std::unique_ptr<Token>> v;
+    Position p(gFileName, 1, 1);
+    v.emplace_back(new IdentifierToken(p, "sum"));
+    v.emplace_back(new CharToken(p, '('));
+    v.emplace_back(new IdentifierToken(p, "i"));
+    v.emplace_back(new CharToken(p, '='));
+    v.emplace_back(new NumberToken(p, 0));
+    v.emplace_back(new CharToken(p, ','));
+    v.emplace_back(new NumberToken(p, 10));
+    v.emplace_back(new CharToken(p, ','));
+    v.emplace_back(new IdentifierToken(p, "i"));
+    v.emplace_back(new CharToken(p, ')'));
+    v.emplace_back(new EofToken(p));
+    auto it = v.begin();
+    std::unique_ptr<ExprNode> node = parseExpr(it);
+    auto n = dynamic_cast<ReductionExprNode*>(node.get());
+    ASSERT_NE(nullptr, n);
+    EXPECT_EQ(ReductionExprNode::Sum, n->kind());
+    EXPECT_EQ("i", n->variable());
+    EXPECT_NE(nullptr, dynamic_cast<const VariableExprNode*>(n->body()));
+}
+
+TEST(ParseTest, SumWithoutIndexIsACall) {
+    std::vector<std::unique_ptr<Token>> v;
+    Position p(gFileName, 1, 1);
+    v.emplace_back(new IdentifierToken(p, "sum"));
+    v.emplace_back(new CharToken(p, '('));
+    v.emplace_back(new IdentifierToken(p, "x"));
+    v.emplace_back(new CharToken(p, ')'));
+    v.emplace_back(new EofToken(p));
+    auto it = v.begin();
+    std::unique_ptr<ExprNode> node = parseExpr(it);
+    EXPECT_NE(nullptr, dynamic_cast<CallExprNode*>(node.get()));
+}
+
+TEST(ParseTest, InfersBooleanExpressions) {
+    Position p(gFileName, 1, 1);
+    auto variable = [&](const char* name) {
+        return std::unique_ptr<ExprNode>(new VariableExprNode(p, name));
+    };
+    auto binary = [&](Operator op, std::unique_ptr<ExprNode> lhs, std::unique_ptr<ExprNode> rhs) {
+        return std::unique_ptr<ExprNode>(new BinaryExprNode(p, op, std::move(lhs), std::move(rhs)));
+    };
+
+    EXPECT_TRUE(binary('<', variable("a"), variable("b"))->boolean());
+    EXPECT_TRUE(binary('*', binary('<', variable("a"), variable("b")),
+                       binary('<', variable("c"), variable("d")))->boolean());
+    EXPECT_FALSE(binary('*', binary('<', variable("a"), variable("b")), variable("c"))->boolean());
+    EXPECT_FALSE(binary('+', binary('<', variable("a"), variable("b")),
+                        binary('<', variable("c"), variable("d")))->boolean());
+    EXPECT_FALSE(variable("a")->boolean());
+}
+
+// Run `program` and return what it prints.
+std::string run(const std::string& program, Options options = Options())
+{
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    std::istringstream input(program);
+    auto tokens = tokenize(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), gFileName);
+    options.emit = EmitMode::None;
+    llvm::LLVMContext llvmContext;
+    std::ostringstream out;
+    auto it = tokens.begin();
+    parseAndPrint(it, options, llvmContext, out, out);
+    return out.str();
+}
+
+TEST(CodegenTest, ReductionWithNaNOrHugeBoundDoesNotLoop) {
+    // sqrt(0 - 1) is NaN, and the span of the third reduction is hugely negative
+    EXPECT_EQ("Evaluated to 0\nEvaluated to -inf\nEvaluated to 0\n",
+              run("extern sqrt(x);\n"
+                  "sum(i = 0, sqrt(0 - 1), 1);\n"
+                  "max(i = sqrt(0 - 1), 10, i);\n"
+                  "sum(i = 100000000000000000000000, 0, 1);\n"));
+}
+
+TEST(CodegenTest, ReductionClampsTripCountBeforeConverting) {
+    Position p(gFileName, 1, 1);
+    auto variable = [&](const char* name) {
+        return std::shared_ptr<const ExprNode>(new VariableExprNode(p, name));
+    };
+    std::unique_ptr<PrototypeNode> proto(new PrototypeNode(p, "f", std::vector<std::string>{"a", "b"}));
+    FunctionNode node(std::move(proto), std::make_shared<ReductionExprNode>(
+            p, ReductionExprNode::Sum, "i", variable("a"), variable("b"), variable("i")));
+
+    llvm::LLVMContext llvmContext;
+    Context context(new llvm::Module("test", llvmContext), llvmContext);
+    llvm::Function* f = node.Codegen(context);
+
+    const llvm::FPToSIInst* conversion = nullptr;
+    for (const llvm::BasicBlock& block : *f) {
+        for (const llvm::Instruction& instruction : block) {
+            if (auto i = llvm::dyn_cast<llvm::FPToSIInst>(&instruction))
+                conversion = i;
+        }
+    }
+    ASSERT_NE(nullptr, conversion);
+
+    // select(span > 0, select(span > 2^62, 2^62, span), 0)
+    auto runs = llvm::dyn_cast<llvm::SelectInst>(conversion->getOperand(0));
+    ASSERT_NE(nullptr, runs);
+    auto zero = llvm::dyn_cast<llvm::ConstantFP>(runs->getFalseValue());
+    ASSERT_NE(nullptr, zero);
+    EXPECT_TRUE(zero->isZero());
+    auto clamped = llvm::dyn_cast<llvm::SelectInst>(runs->getTrueValue());
+    ASSERT_NE(nullptr, clamped);
+    auto maxSpan = llvm::dyn_cast<llvm::ConstantFP>(clamped->getTrueValue());
+    ASSERT_NE(nullptr, maxSpan);
+    EXPECT_EQ(4611686018427387904.0, maxSpan->getValueAPF().convertToDouble());
+    auto tooLong = llvm::dyn_cast<llvm::FCmpInst>(clamped->getCondition());
+    ASSERT_NE(nullptr, tooLong);
+    EXPECT_EQ(llvm::CmpInst::FCMP_OGT, tooLong->getPredicate());
+    EXPECT_EQ(maxSpan, tooLong->getOperand(1));
+}
+
+TEST(CodegenTest, FailedDefinitionCannotBeCalled) {
+    EXPECT_EQ("test:1:11: unknown variable name\n"
+              "test:2:3: unknown function referenced\n",
+              run("def f(x) y;\n"
+                  "f(1);\n"));
+}
+
+TEST(CodegenTest, ReportsCallsToUndefinedExterns) {
+    EXPECT_EQ("Evaluated to 2\n"
+              "test:2:8: unresolved function referenced: nosuch\n",
+              run("extern nosuch(x);\n"
+                  "nosuch(1);\n"
+                  "2;\n"));
+}
+
+TEST(CodegenTest, ReportsCallsReachingUndefinedExterns) {
+    EXPECT_EQ("Evaluated to 3\n"
+              "test:3:3: unresolved function referenced: g\n",
+              run("extern g(x);\n"
+                  "def f(x) g(x);\n"
+                  "f(1);\n"
+                  "def g(x) x + 2;\n"
+                  "f(1);\n"));
+}
+
+std::atomic<int> gRunningCalls(0);
+std::atomic<int> gOverlappingCalls(0);
+
+// An extern with a side effect, which notices calls running at the same time.
+extern "C" double recordCall(double)
+{
+    if (gRunningCalls.fetch_add(1) != 0)
+        ++gOverlappingCalls;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    gRunningCalls.fetch_sub(1);
+    return 0;
+}
+
+TEST(CodegenTest, RunsExpressionsCallingExternsOneAtATime) {
+    llvm::sys::DynamicLibrary::AddSymbol("recordCall", reinterpret_cast<void*>(&recordCall));
+    std::string program = "extern recordCall(x);\n" "def f(x) recordCall(x);\n";
+    for (int i = 0; i < 16; ++i)
+        program += "f(" + std::to_string(i) + ");\n";
+
+    Options options;
+    options.jobs = 4;
+    run(program, options);
+    EXPECT_EQ(0, gOverlappingCalls.load());
+}
+
+TEST(PipelineTest, PrintsWhatTheSequentialDriverPrints) {
+    const std::string valid =
+        "def f(x) x * 2;\n"
+        "f(3);\n"
+        "def g(x) y;\n"          // codegen error
+        "g(1);\n"
+        "f(;\n"                  // parse error
+        "extern sin(a);\n"
+        "sin(0) + f(1); f(2);\n";
+    // tokenization error; it starts an item, so the pipeline has nothing partial to parse
+    const std::string program = valid + "..;\n" "f(4);\n";
+
+    std::string expected = run(valid);
+    try {
+        std::istringstream input(program);
+        tokenize(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), gFileName);
+        FAIL() << "no tokenization error";
+    } catch (const TokenizationError& e) {
+        // the sequential driver reports only this; the pipeline runs what precedes it first
+        expected += e.position().toString() + ": " + e.message() + "\n";
+    }
+
+    std::istringstream input(program);
+    Options options;
+    options.emit = EmitMode::None;
+    llvm::LLVMContext llvmContext;
+    std::ostringstream out;
+    parseAndPrintPipelined(input, gFileName, options, llvmContext, out, out);
+    EXPECT_EQ(expected, out.str());
+}
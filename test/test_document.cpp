@@ -0,0 +1,78 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "document.hpp"
+
+using namespace kaleidoscope;
+
+const char* const kText =
+    "def f(x) x + 1;\n"
+    "extern sin(a);\n"
+    "def g(y) f(y) * 2;\n"
+    "g(3);\n";
+
+TEST(DocumentTest, ParsesItems) {
+    Document document("test", kText);
+    const std::vector<const Node*> items = document.items();
+    ASSERT_EQ(4u, items.size());
+    EXPECT_NE(nullptr, dynamic_cast<const FunctionNode*>(items[0]));
+    EXPECT_NE(nullptr, dynamic_cast<const PrototypeNode*>(items[1]));
+    EXPECT_TRUE(document.diagnostics()->empty());
+}
+
+TEST(DocumentTest, ReportsChangedDefinition) {
+    Document document("test", kText);
+    const std::string text = document.text();
+    const Document::Changes changes = document.edit(text.find("* 2"), 3, "* 3");
+    ASSERT_EQ(1u, changes.changedDefinitions.size());
+    EXPECT_EQ("g", changes.changedDefinitions[0]);
+    EXPECT_TRUE(changes.removedDefinitions.empty());
+    EXPECT_LT(changes.relexedBytes, text.size());
+}
+
+TEST(DocumentTest, IgnoresWhitespaceChanges) {
+    Document document("test", kText);
+    const Document::Changes changes = document.edit(document.text().find("x + 1"), 0, "  ");
+    EXPECT_TRUE(changes.changedDefinitions.empty());
+    EXPECT_TRUE(changes.removedDefinitions.empty());
+}
+
+TEST(DocumentTest, ReportsRemovedDefinition) {
+    Document document("test", kText);
+    const Document::Changes changes = document.edit(document.text().find("def g"), 3, "");
+    EXPECT_EQ(std::vector<std::string>{ "g" }, changes.removedDefinitions);
+}
+
+TEST(DocumentTest, KeepsDiagnosticPositionsAcrossEdits) {
+    Document document("test", kText);
+    document.edit(document.text().find("g(3)"), 4, "g(3");
+    auto before = document.diagnostics();
+    ASSERT_EQ(1u, before->size());
+    EXPECT_EQ(4u, before->position(0).line());
+
+    document.edit(0, 0, "\n\n");
+    auto after = document.diagnostics();
+    ASSERT_EQ(1u, after->size());
+    EXPECT_EQ(6u, after->position(0).line());
+    EXPECT_EQ(before->position(0).column(), after->position(0).column());
+}
+
+TEST(DocumentTest, TranslatesItemPositions) {
+    Document document("test", kText);
+    document.edit(0, 0, "\n  ");
+    const std::vector<const Node*> items = document.items();
+    ASSERT_EQ(4u, items.size());
+
+    // the prototype of f starts the first line of its chunk, after the two spaces
+    auto f = dynamic_cast<const FunctionNode*>(items[0]);
+    ASSERT_NE(nullptr, f);
+    const Position p = document.absolutePosition(0, f->prototype()->position());
+    EXPECT_EQ(2u, p.line());
+    EXPECT_EQ(f->prototype()->position().column() + 2, p.column());
+
+    auto g = dynamic_cast<const FunctionNode*>(items[2]);
+    ASSERT_NE(nullptr, g);
+    EXPECT_EQ(4u, document.absolutePosition(2, g->body()->position()).line());
+}
@@ -0,0 +1,65 @@
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ast.hpp"
+#include "expr_table.hpp"
+#include "token.hpp"
+
+using namespace kaleidoscope;
+
+std::string gFileName("test");
+
+std::shared_ptr<const ExprNode> internString(ExprTable& table, const std::string& str)
+{
+    std::istringstream stream(str);
+    auto tokens = tokenize(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(), gFileName);
+    auto it = tokens.begin();
+    return table.intern(*parseExpr(it));
+}
+
+TEST(ExprTableTest, SharesIdenticalSubtrees) {
+    ExprTable table;
+    auto node = internString(table, "(x + 1) * (x + 1)");
+    auto n = dynamic_cast<const BinaryExprNode*>(node.get());
+    ASSERT_NE(nullptr, n);
+    EXPECT_EQ(n->lhs(), n->rhs());
+    EXPECT_TRUE(n->lhs()->shared());
+    EXPECT_FALSE(n->shared());
+    EXPECT_EQ(7u, table.internedCount());
+    EXPECT_EQ(4u, table.size());
+}
+
+TEST(ExprTableTest, KeepsDifferentSubtreesApart) {
+    ExprTable table;
+    auto node = internString(table, "foo(x, 1) - foo(1, x)");
+    auto n = dynamic_cast<const BinaryExprNode*>(node.get());
+    ASSERT_NE(nullptr, n);
+    EXPECT_NE(n->lhs(), n->rhs());
+}
+
+TEST(ExprTableTest, SharesNothingAcrossExpressions) {
+    ExprTable table;
+    auto a = internString(table, "sin(y) + 2");
+    auto b = internString(table, "  sin(y) + 2");
+    EXPECT_NE(a.get(), b.get());
+    EXPECT_FALSE(a->shared());
+
+    auto na = dynamic_cast<const BinaryExprNode*>(a.get());
+    auto nb = dynamic_cast<const BinaryExprNode*>(b.get());
+    ASSERT_NE(nullptr, na);
+    ASSERT_NE(nullptr, nb);
+    EXPECT_NE(na->rhs(), nb->rhs());
+    // the variable of the second expression reports its own position
+    auto ca = dynamic_cast<const CallExprNode*>(na->lhs());
+    auto cb = dynamic_cast<const CallExprNode*>(nb->lhs());
+    ASSERT_NE(nullptr, ca);
+    ASSERT_NE(nullptr, cb);
+    EXPECT_EQ(ca->argument(0)->position().column() + 2, cb->argument(0)->position().column());
+    EXPECT_EQ(8u, table.internedCount());
+    EXPECT_EQ(8u, table.size());
+}
@@ -0,0 +1,74 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "function_registry.hpp"
+
+using namespace kaleidoscope;
+
+TEST(FunctionRegistryTest, LooksUpPublishedFunctions) {
+    FunctionRegistry registry;
+    EXPECT_EQ(0u, registry.lookup("foo"));
+    registry.publish("foo", 0x1000);
+    registry.publish("bar", 0x2000);
+    EXPECT_EQ(0x1000u, registry.lookup("foo"));
+    EXPECT_EQ(0x2000u, registry.lookup("bar"));
+    EXPECT_EQ(0u, registry.lookup("baz"));
+}
+
+TEST(FunctionRegistryTest, RepublishingReplacesTheEntryPoint) {
+    FunctionRegistry registry;
+    registry.publish("foo", 0x1000);
+    registry.publish("foo", 0x3000);
+    EXPECT_EQ(0x3000u, registry.lookup("foo"));
+}
+
+TEST(FunctionRegistryTest, WithdrawsEntryPoints) {
+    FunctionRegistry registry;
+    registry.publish("foo", 0x1000);
+    registry.publish("bar", 0x2000);
+    registry.withdraw("foo");
+    registry.withdraw("baz");
+    EXPECT_EQ(0u, registry.lookup("foo"));
+    EXPECT_EQ(0x2000u, registry.lookup("bar"));
+}
+
+TEST(FunctionRegistryTest, FreesReplacedTablesWithoutReaders) {
+    FunctionRegistry registry;
+    for (uint64_t i = 1; i <= 100; ++i)
+        registry.publish("foo", i);
+    EXPECT_EQ(0u, registry.retiredCount());
+}
+
+TEST(FunctionRegistryTest, ReadsWhilePublishing) {
+    const uint64_t count = 20000;
+    FunctionRegistry registry;
+    std::atomic<bool> done(false);
+
+    // Each name is published with increasing addresses, so a reader must never
+    // see one go back.
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            uint64_t last[4] = {};
+            while (!done.load()) {
+                for (int i = 0; i < 4; ++i) {
+                    const uint64_t address = registry.lookup("f" + std::to_string(i));
+                    EXPECT_LE(last[i], address);
+                    last[i] = address;
+                }
+            }
+        });
+    }
+    for (uint64_t n = 1; n <= count; ++n)
+        registry.publish("f" + std::to_string(n % 4), n);
+    done.store(true);
+    for (auto& reader : readers)
+        reader.join();
+
+    for (int i = 0; i < 4; ++i)
+        EXPECT_EQ(count - (count - i) % 4, registry.lookup("f" + std::to_string(i)));
+}
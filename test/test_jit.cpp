@@ -0,0 +1,84 @@
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "jit.hpp"
+
+using namespace kaleidoscope;
+
+namespace {
+
+    // A module defining `name`(x) as `callee`(x) + `addend`, or as x + `addend`
+    // if `callee` is empty. `callee` is only declared.
+    std::unique_ptr<llvm::Module> makeModule(llvm::LLVMContext& context, const std::string& name,
+                                             const std::string& callee, double addend)
+    {
+        std::unique_ptr<llvm::Module> module(new llvm::Module(name, context));
+        llvm::Type* doubleType = llvm::Type::getDoubleTy(context);
+        llvm::FunctionType* type = llvm::FunctionType::get(doubleType, {doubleType}, false);
+
+        llvm::Function* f = llvm::Function::Create(
+                type, llvm::Function::ExternalLinkage, name, module.get());
+        llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", f));
+        llvm::Value* x = &*f->arg_begin();
+        if (!callee.empty()) {
+            llvm::Function* g = llvm::Function::Create(
+                    type, llvm::Function::ExternalLinkage, callee, module.get());
+            x = builder.CreateCall(g, {x});
+        }
+        builder.CreateRet(builder.CreateFAdd(x, llvm::ConstantFP::get(doubleType, addend)));
+        return module;
+    }
+
+    class JitTest: public ::testing::Test {
+    protected:
+        static void SetUpTestCase() {
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+            llvm::InitializeNativeTargetAsmParser();
+        }
+
+        double call(Jit::ModuleHandle handle, const std::string& name, double x) {
+            auto f = reinterpret_cast<double (*)(double)>(jit.getFunctionAddress(handle, name));
+            return f(x);
+        }
+
+        llvm::LLVMContext context;
+        Jit jit{Options()};
+    };
+
+}   // anonymous namespace
+
+TEST_F(JitTest, PublishesDefinitions) {
+    jit.addDefinitions(makeModule(context, "g", "", 1), {"g"});
+    auto handle = jit.addDefinitions(makeModule(context, "f", "g", 10), {"f"});
+    ASSERT_NE(0u, jit.lookup(jit.mangle("g")));
+    ASSERT_NE(0u, jit.lookup(jit.mangle("f")));
+    EXPECT_EQ(jit.getFunctionAddress(handle, "f"), jit.lookup(jit.mangle("f")));
+    auto f = reinterpret_cast<double (*)(double)>(jit.lookup(jit.mangle("f")));
+    EXPECT_EQ(12.0, f(1));
+}
+
+TEST_F(JitTest, DefersDefinitionsCallingUnknownFunctions) {
+    // f calls g, which is defined afterwards; linking f early would abort
+    auto handle = jit.addDefinitions(makeModule(context, "f", "g", 10), {"f"});
+    EXPECT_EQ(0u, jit.lookup(jit.mangle("f")));
+    jit.addDefinitions(makeModule(context, "g", "", 1), {"g"});
+    EXPECT_EQ(12.0, call(handle, "f", 1));
+}
+
+TEST_F(JitTest, DeferredRedefinitionHidesPublishedOne) {
+    jit.addDefinitions(makeModule(context, "f", "", 1), {"f"});
+    ASSERT_NE(0u, jit.lookup(jit.mangle("f")));
+    jit.addDefinitions(makeModule(context, "f", "g", 10), {"f"});
+    EXPECT_EQ(0u, jit.lookup(jit.mangle("f")));
+
+    jit.addDefinitions(makeModule(context, "g", "", 100), {"g"});
+    auto handle = jit.addModule(makeModule(context, "h", "f", 0), JitMemory::Transient);
+    EXPECT_EQ(111.0, call(handle, "h", 1));
+}
@@ -0,0 +1,98 @@
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "jit_memory.hpp"
+
+using namespace kaleidoscope;
+
+namespace {
+
+    // x86-64: mov eax, 42; ret
+    // It is only run on x86-64; elsewhere it is just bytes to allocate and protect.
+    const uint8_t kReturn42[] = { 0xb8, 0x2a, 0x00, 0x00, 0x00, 0xc3 };
+
+    uint8_t* loadReturn42(llvm::RTDyldMemoryManager& manager)
+    {
+        uint8_t* code = manager.allocateCodeSection(sizeof(kReturn42), 16, 0, ".text");
+        std::memcpy(code, kReturn42, sizeof(kReturn42));
+        std::string error;
+        EXPECT_FALSE(manager.finalizeMemory(&error)) << error;
+        return code;
+    }
+
+}   // anonymous namespace
+
+#if defined(__x86_64__)
+TEST(JitMemoryTest, RunsFinalizedCode) {
+    JitMemory memory(false);
+    auto manager = memory.createMemoryManager(JitMemory::Persistent);
+    uint8_t* code = loadReturn42(*manager);
+    EXPECT_EQ(42, reinterpret_cast<int (*)()>(code)());
+}
+#endif
+
+TEST(JitMemoryTest, SharesSlabsBetweenModules) {
+    JitMemory memory(false);
+    auto first = memory.createMemoryManager(JitMemory::Persistent);
+    auto second = memory.createMemoryManager(JitMemory::Persistent);
+    loadReturn42(*first);
+    uint8_t* code = loadReturn42(*second);
+#if defined(__x86_64__)
+    EXPECT_EQ(42, reinterpret_cast<int (*)()>(code)());
+#else
+    (void)code;
+#endif
+
+    const JitMemory::Stats stats = memory.stats();
+    EXPECT_EQ(1u, stats.mmapCalls);
+    EXPECT_EQ(2u, stats.mprotectCalls);
+    EXPECT_EQ(2 * sizeof(kReturn42), stats.usedBytes);
+}
+
+TEST(JitMemoryTest, ProtectsSectionsOfAModuleTogether) {
+    JitMemory memory(false);
+    auto manager = memory.createMemoryManager(JitMemory::Persistent);
+    for (int i = 0; i < 10; ++i)
+        manager->allocateCodeSection(100, 16, i, ".text");
+    manager->allocateDataSection(100, 16, 10, ".data", false);
+    std::string error;
+    EXPECT_FALSE(manager->finalizeMemory(&error)) << error;
+    EXPECT_EQ(1u, memory.stats().mprotectCalls);
+}
+
+TEST(JitMemoryTest, ReusesFreedSlab) {
+    JitMemory memory(false);
+    for (int i = 0; i < 3; ++i) {
+        auto manager = memory.createMemoryManager(JitMemory::Transient);
+        uint8_t* code = loadReturn42(*manager);
+#if defined(__x86_64__)
+        EXPECT_EQ(42, reinterpret_cast<int (*)()>(code)());
+#else
+        (void)code;
+#endif
+    }
+    const JitMemory::Stats stats = memory.stats();
+    EXPECT_EQ(1u, stats.mmapCalls);
+    EXPECT_EQ(0u, stats.usedBytes);
+    EXPECT_EQ(0u, stats.wastedBytes);
+}
+
+TEST(JitMemoryTest, KeepsHotCodeApart) {
+    JitMemory memory(false);
+    auto first = memory.createMemoryManager(JitMemory::Hot);
+    auto persistent = memory.createMemoryManager(JitMemory::Persistent);
+    auto second = memory.createMemoryManager(JitMemory::Hot);
+    uint8_t* firstCode = first->allocateCodeSection(16, 16, 0, ".text");
+    persistent->allocateCodeSection(16, 16, 0, ".text");
+    uint8_t* secondCode = second->allocateCodeSection(16, 16, 0, ".text");
+    EXPECT_EQ(2u, memory.stats().mmapCalls);
+
+    // The code of the second hot module follows the first in their slab, from the
+    // next page, although persistent code was loaded in between.
+    EXPECT_EQ(firstCode + ::sysconf(_SC_PAGESIZE), secondCode);
+}
@@ -0,0 +1,30 @@
+#include <new>
+
+#include <gtest/gtest.h>
+
+#include "memory_profile.hpp"
+
+using namespace kaleidoscope;
+
+TEST(MemoryProfileTest, ChargesAllocationsToThePhaseInScope) {
+    MemoryProfile::enable();
+    const MemoryProfile::Counters lexBefore = MemoryProfile::counters(Phase::Lex);
+    const MemoryProfile::Counters parseBefore = MemoryProfile::counters(Phase::Parse);
+    const int64_t liveBefore = MemoryProfile::liveBytes();
+
+    // called directly, since a new-expression paired with delete may be optimized away
+    void* p;
+    {
+        const PhaseScope phase(Phase::Lex);
+        p = ::operator new(1000);
+    }
+    const MemoryProfile::Counters lexAfter = MemoryProfile::counters(Phase::Lex);
+    EXPECT_EQ(lexBefore.allocations + 1, lexAfter.allocations);
+    EXPECT_LE(lexBefore.bytes + 1000, lexAfter.bytes);
+    EXPECT_LE(static_cast<uint64_t>(liveBefore + 1000), lexAfter.peakBytes);
+    EXPECT_LE(liveBefore + 1000, MemoryProfile::liveBytes());
+    EXPECT_EQ(parseBefore.allocations, MemoryProfile::counters(Phase::Parse).allocations);
+
+    ::operator delete(p);
+    EXPECT_EQ(liveBefore, MemoryProfile::liveBytes());
+}
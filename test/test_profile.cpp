@@ -0,0 +1,73 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/TargetSelect.h>
+
+#include "ast.hpp"
+
+using namespace kaleidoscope;
+
+namespace {
+
+    const std::string kFileName("test");
+
+    // Run `program` with --profile and return the lines of the dumped profile.
+    std::vector<std::string> runAndDumpProfile(const std::string& program)
+    {
+        llvm::InitializeNativeTarget();
+        llvm::InitializeNativeTargetAsmPrinter();
+        llvm::InitializeNativeTargetAsmParser();
+
+        char path[] = "/tmp/kaleidoscope_profileXXXXXX";
+        const int fd = mkstemp(path);
+        EXPECT_NE(-1, fd);
+        close(fd);
+
+        std::istringstream input(program);
+        auto tokens = tokenize(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>(), kFileName);
+        Options options;
+        options.profile = true;
+        options.profileOutput = path;
+        options.emit = EmitMode::None;
+        llvm::LLVMContext llvmContext;
+        std::ostringstream out;
+        auto it = tokens.begin();
+        parseAndPrint(it, options, llvmContext, out, out);
+
+        std::ifstream file(path);
+        std::vector<std::string> lines;
+        for (std::string line; std::getline(file, line);)
+            lines.push_back(line);
+        std::remove(path);
+        return lines;
+    }
+
+}   // anonymous namespace
+
+TEST(ProfileTest, DumpsReadableKeys) {
+    const auto lines = runAndDumpProfile("def f(x) x < 1;\nf(0);\nf(2);\n");
+    ASSERT_FALSE(lines.empty());
+
+    std::map<std::string, uint64_t> counts;
+    for (const auto& line : lines) {
+        EXPECT_EQ(std::string::npos, line.find('\0'));
+        const size_t space = line.rfind(' ');
+        ASSERT_NE(std::string::npos, space) << line;
+        counts[line.substr(0, space)] = std::stoull(line.substr(space + 1));
+    }
+
+    EXPECT_EQ(2u, counts["entry f"]);
+    EXPECT_EQ(1u, counts["call test:2:3 f"]);
+    EXPECT_EQ(1u, counts["call test:3:3 f"]);
+    EXPECT_EQ(2u, counts["compare test:1:12 total"]);
+    EXPECT_EQ(1u, counts["compare test:1:12 true"]);
+}
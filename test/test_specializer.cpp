@@ -0,0 +1,110 @@
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "ast.hpp"
+#include "specializer.hpp"
+#include "token.hpp"
+
+using namespace kaleidoscope;
+
+std::string gFileName("test");
+
+std::unique_ptr<ExprNode> parseString(const std::string& str)
+{
+    std::istringstream stream(str);
+    auto tokens = tokenize(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(), gFileName);
+    auto it = tokens.begin();
+    return parseExpr(it);
+}
+
+void define(std::map<std::string, std::unique_ptr<FunctionNode>>& definitions,
+            const std::string& name, const std::vector<std::string>& args, const std::string& body)
+{
+    std::unique_ptr<PrototypeNode> proto(new PrototypeNode(Position(gFileName, 1, 1), name, args));
+    definitions[name].reset(new FunctionNode(std::move(proto), parseString(body)));
+}
+
+TEST(SpecializerTest, SpecializesAfterThreshold) {
+    std::map<std::string, std::unique_ptr<FunctionNode>> definitions;
+    define(definitions, "f", {"x", "y"}, "x * y + y * 2");
+    Specializer specializer(definitions, 2, 100);
+
+    auto first = specializer.rewrite("__anon_expr0", *parseString("f(a, 3)"));
+    auto call = dynamic_cast<const CallExprNode*>(first.get());
+    ASSERT_NE(nullptr, call);
+    EXPECT_EQ("f", call->callee());
+    EXPECT_TRUE(specializer.takeNewFunctions().empty());
+
+    auto second = specializer.rewrite("__anon_expr0", *parseString("f(b, 3)"));
+    call = dynamic_cast<const CallExprNode*>(second.get());
+    ASSERT_NE(nullptr, call);
+    EXPECT_EQ("f.spec0", call->callee());
+    ASSERT_EQ(1u, call->argumentCount());
+
+    auto functions = specializer.takeNewFunctions();
+    ASSERT_EQ(1u, functions.size());
+    EXPECT_EQ("f.spec0", functions[0]->prototype()->name());
+    ASSERT_EQ(1u, functions[0]->prototype()->argumentCount());
+    EXPECT_EQ("x", functions[0]->prototype()->argument(0));
+
+    // y * 2 has been folded
+    auto body = dynamic_cast<const BinaryExprNode*>(functions[0]->body());
+    ASSERT_NE(nullptr, body);
+    auto folded = dynamic_cast<const NumberExprNode*>(body->rhs());
+    ASSERT_NE(nullptr, folded);
+    EXPECT_EQ(6.0, folded->value());
+}
+
+TEST(SpecializerTest, RespectsBudget) {
+    std::map<std::string, std::unique_ptr<FunctionNode>> definitions;
+    define(definitions, "f", {"x", "y"}, "x * y + y * 2");
+    Specializer specializer(definitions, 1, 2);
+
+    auto node = specializer.rewrite("__anon_expr0", *parseString("f(a, 3)"));
+    auto call = dynamic_cast<const CallExprNode*>(node.get());
+    ASSERT_NE(nullptr, call);
+    EXPECT_EQ("f", call->callee());
+    EXPECT_TRUE(specializer.takeNewFunctions().empty());
+}
+
+TEST(SpecializerTest, LeavesCallsToItselfAlone) {
+    std::map<std::string, std::unique_ptr<FunctionNode>> definitions;
+    define(definitions, "f", {"x"}, "x + 1");
+    Specializer specializer(definitions, 1, 100);
+
+    auto node = specializer.rewrite("f", *parseString("f(1)"));
+    auto call = dynamic_cast<const CallExprNode*>(node.get());
+    ASSERT_NE(nullptr, call);
+    EXPECT_EQ("f", call->callee());
+}
+
+TEST(SpecializerTest, FoldsComparisonsWithNaNAsTrue) {
+    std::map<std::string, std::unique_ptr<FunctionNode>> definitions;
+    define(definitions, "f", {"x", "y"}, "x + (y < 1)");
+    Specializer specializer(definitions, 1, 100);
+
+    // no literal is NaN, so build the call by hand
+    const Position pos(gFileName, 1, 1);
+    std::vector<std::shared_ptr<const ExprNode>> args;
+    args.push_back(std::make_shared<VariableExprNode>(pos, "a"));
+    args.push_back(std::make_shared<NumberExprNode>(pos, std::numeric_limits<double>::quiet_NaN()));
+    auto node = specializer.rewrite("__anon_expr0", CallExprNode(pos, "f", std::move(args)));
+    auto call = dynamic_cast<const CallExprNode*>(node.get());
+    ASSERT_NE(nullptr, call);
+    EXPECT_EQ("f.spec0", call->callee());
+
+    auto functions = specializer.takeNewFunctions();
+    ASSERT_EQ(1u, functions.size());
+    auto body = dynamic_cast<const BinaryExprNode*>(functions[0]->body());
+    ASSERT_NE(nullptr, body);
+    auto folded = dynamic_cast<const NumberExprNode*>(body->rhs());
+    ASSERT_NE(nullptr, folded);
+    EXPECT_EQ(1.0, folded->value());
+}
@@ -0,0 +1,77 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "spsc_queue.hpp"
+
+using namespace kaleidoscope;
+
+TEST(SpscQueueTest, PopsInPushOrder) {
+    SpscQueue<int> queue(4);
+    int value;
+    EXPECT_FALSE(queue.tryPop(&value));
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(queue.tryPush(int(i)));
+    EXPECT_FALSE(queue.tryPush(4));
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(queue.tryPop(&value));
+        EXPECT_EQ(i, value);
+    }
+    EXPECT_FALSE(queue.tryPop(&value));
+}
+
+TEST(SpscQueueTest, RoundsCapacityUpToAPowerOfTwo) {
+    SpscQueue<int> queue(3);
+    for (int i = 0; i < 4; ++i)
+        EXPECT_TRUE(queue.tryPush(int(i)));
+    EXPECT_FALSE(queue.tryPush(4));
+}
+
+TEST(SpscQueueTest, MovesOnlyOnSuccess) {
+    SpscQueue<std::unique_ptr<int>> queue(1);
+    EXPECT_TRUE(queue.tryPush(std::unique_ptr<int>(new int(1))));
+    std::unique_ptr<int> p(new int(2));
+    EXPECT_FALSE(queue.tryPush(std::move(p)));
+    ASSERT_NE(nullptr, p);
+    EXPECT_EQ(2, *p);
+}
+
+TEST(SpscQueueTest, TransfersBetweenThreads) {
+    const size_t count = 100000;
+    SpscQueue<size_t> queue(16);
+    std::thread producer([&] {
+        for (size_t i = 0; i < count; ++i)
+            queue.push(size_t(i));
+    });
+    for (size_t i = 0; i < count; ++i) {
+        size_t value;
+        queue.pop(&value);
+        ASSERT_EQ(i, value);
+    }
+    producer.join();
+}
+
+TEST(SpscQueueTest, WakesConsumerBlockedOnDoorbell) {
+    Doorbell doorbell;
+    SpscQueue<int> queue(1, &doorbell);
+    std::thread producer([&] {
+        // long enough for the consumer to exhaust its backoff and block
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        queue.push(1);
+    });
+    int value;
+    queue.pop(&value);
+    EXPECT_EQ(1, value);
+    producer.join();
+}
+
+TEST(DoorbellTest, SleepReturnsAtOnceIfRungSinceEpoch) {
+    Doorbell doorbell;
+    const uint64_t epoch = doorbell.epoch();
+    doorbell.ring();
+    doorbell.sleep(epoch);
+    EXPECT_NE(epoch, doorbell.epoch());
+}
@@ -0,0 +1,25 @@
+#include <atomic>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "thread_pool.hpp"
+
+using namespace kaleidoscope;
+
+TEST(ThreadPoolTest, CallsEveryIndexOnce) {
+    ThreadPool pool(4);
+    std::vector<int> calls(1000, 0);
+    pool.parallelFor(calls.size(), [&](size_t i) { ++calls[i]; });
+    for (size_t i = 0; i < calls.size(); ++i)
+        EXPECT_EQ(1, calls[i]);
+}
+
+TEST(ThreadPoolTest, RunsManyLoopsInARow) {
+    ThreadPool pool(3);
+    for (size_t n = 0; n < 100; ++n) {
+        std::atomic<size_t> sum(0);
+        pool.parallelFor(n, [&](size_t i) { sum += i; });
+        EXPECT_EQ(n * (n - 1) / 2, sum);
+    }
+}
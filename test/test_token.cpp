@@ -93,3 +93,33 @@ TEST(TokenizeTest, Prototype) {
     assertIdentifierToken(tokens[3].get(), "x");
     assertCharToken(tokens[4].get(), ')');
 }
+
+TEST(TokenizeTest, PrintMatchesToString) {
+    auto tokens = tokenizeString("def foo(x) extern 1.5e3 * x;");
+    for (const auto& token : tokens) {
+        std::ostringstream out;
+        token->print(out);
+        EXPECT_EQ(token->toString(), out.str());
+    }
+}
+
+TEST(LexerTest, ReturnsTokensOneAtATime) {
+    std::istringstream stream("foo(1);");
+    Lexer lexer(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(), gFileName);
+    assertIdentifierToken(lexer.next().get(), "foo");
+    assertCharToken(lexer.next().get(), '(');
+    assertNumberToken(lexer.next().get(), 1);
+    assertCharToken(lexer.next().get(), ')');
+    assertCharToken(lexer.next().get(), ';');
+    assertEofToken(lexer.next().get());
+    assertEofToken(lexer.next().get());
+}
+
+TEST(LexerTest, DoesNotReadPastACharToken) {
+    std::istringstream stream("a;b");
+    Lexer lexer(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>(), gFileName);
+    assertIdentifierToken(lexer.next().get(), "a");
+    assertCharToken(lexer.next().get(), ';');
+    EXPECT_EQ(2, stream.rdbuf()->pubseekoff(0, std::ios::cur, std::ios::in));
+    assertIdentifierToken(lexer.next().get(), "b");
+}